@@ -0,0 +1,133 @@
+//
+//  arena.c
+//  de
+//
+
+#include "arena.h"
+#include "common.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGNMENT alignof(max_align_t)
+
+struct ArenaBlock
+{
+    ArenaBlock * next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+static size_t Align(size_t size)
+{
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+Arena * NewArena(size_t blockSize)
+{
+    Arena * arena = calloc(1, sizeof(*arena));
+    ASSERT(arena != NULL);
+    arena->blockSize = blockSize;
+
+    return arena;
+}
+
+void FreeArena(Arena * arena)
+{
+    ArenaBlock * block = arena->blocks;
+    while ( block )
+    {
+        ArenaBlock * next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+void ResetArena(Arena * arena)
+{
+    for ( ArenaBlock * block = arena->blocks; block; block = block->next )
+        block->used = 0;
+
+    arena->current = arena->blocks;
+    arena->used = 0;
+}
+
+void * ArenaAlloc(Arena * arena, size_t size)
+{
+    size = Align(size);
+
+    // Move on to the first block with room, kept from before a reset or new.
+    ArenaBlock * block = arena->current;
+    while ( block && block->size - block->used < size )
+    {
+        if ( block->next == NULL )
+            break;
+
+        block = block->next;
+    }
+
+    if ( block == NULL || block->size - block->used < size )
+    {
+        size_t blockSize = MAX(arena->blockSize, size);
+        ArenaBlock * new = malloc(sizeof(*new) + blockSize);
+        ASSERT(new != NULL);
+
+        new->next = NULL;
+        new->size = blockSize;
+        new->used = 0;
+
+        if ( block )
+            block->next = new;
+        else
+            arena->blocks = new;
+
+        arena->reserved += blockSize;
+        block = new;
+    }
+
+    arena->current = block;
+    void * ptr = block->data + block->used;
+    block->used += size;
+    arena->used += size;
+
+    return ptr;
+}
+
+void * ArenaCalloc(Arena * arena, size_t size)
+{
+    void * ptr = ArenaAlloc(arena, size);
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void * ArenaRealloc(Arena * arena, void * ptr, size_t oldSize, size_t newSize)
+{
+    if ( ptr == NULL )
+        return ArenaAlloc(arena, newSize);
+
+    oldSize = Align(oldSize);
+    newSize = Align(newSize);
+
+    if ( newSize <= oldSize )
+        return ptr;
+
+    // Grow in place if this was the last allocation.
+    ArenaBlock * block = arena->current;
+    if ( (unsigned char *)ptr + oldSize == block->data + block->used
+        && newSize - oldSize <= block->size - block->used )
+    {
+        block->used += newSize - oldSize;
+        arena->used += newSize - oldSize;
+        return ptr;
+    }
+
+    void * new = ArenaAlloc(arena, newSize);
+    memcpy(new, ptr, oldSize);
+
+    return new;
+}
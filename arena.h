@@ -0,0 +1,48 @@
+//
+//  arena.h
+//  de
+//
+//  Region allocator: many allocations that are all released at once.
+//
+
+#ifndef arena_h
+#define arena_h
+
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+/// Memory is handed out from large blocks and never freed individually.
+/// `ResetArena` releases everything at once but keeps the blocks, so an arena
+/// that's reused doesn't go back to the heap once it's large enough.
+typedef struct Arena
+{
+    ArenaBlock * blocks;
+    ArenaBlock * current;   // The block allocations are coming from.
+    size_t       blockSize; // Minimum size of a new block.
+    size_t       used;      // Bytes allocated since the last reset.
+    size_t       reserved;  // Total size of all blocks.
+} Arena;
+
+/// Create an empty arena. No memory is allocated until it is used.
+/// - parameter blockSize: The minimum size of each block.
+Arena * NewArena(size_t blockSize);
+
+/// Free the arena and all memory allocated from it.
+void FreeArena(Arena * arena);
+
+/// Release all allocations.
+void ResetArena(Arena * arena);
+
+/// Allocate `size` bytes, aligned for any type.
+void * ArenaAlloc(Arena * arena, size_t size);
+
+/// Allocate `size` bytes, set to zero.
+void * ArenaCalloc(Arena * arena, size_t size);
+
+/// Grow an allocation of `oldSize` bytes. If `ptr` is the arena's most recent
+/// allocation and there's room it's grown in place. Otherwise it's copied and
+/// the old space is not reused until the arena is reset. Shrinking does nothing.
+void * ArenaRealloc(Arena * arena, void * ptr, size_t oldSize, size_t newSize);
+
+#endif /* arena_h */
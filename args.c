@@ -57,3 +57,19 @@ char * GetOptionArg2(const char * option, const char * alternative)
 
     return arg;
 }
+
+int GetOptionArgs(const char * option, char *** out)
+{
+    int index = GetArg(option);
+    if ( index == -1 ) {
+        return 0;
+    }
+
+    int count = 0;
+    while ( index + 1 + count < _argc && _argv[index + 1 + count][0] != '-' ) {
+        count++;
+    }
+
+    *out = &_argv[index + 1];
+    return count;
+}
@@ -22,4 +22,9 @@ char * GetOptionArg(const char * option);
 /// following the option, or `NULL` on fail.
 char * GetOptionArg2(const char * option, const char * alternative);
 
+/// For an option that takes a list, e.g. --file a.wad b.wad, point `out` to
+/// the arguments following `option` up to the next option and return how many
+/// there are.
+int GetOptionArgs(const char * option, char *** out);
+
 #endif /* args_h */
@@ -6,13 +6,28 @@
 
 #include "array.h"
 
+#include "arena.h"
 #include "common.h"
 #include <string.h>
 
+#if DEBUG
+SDL_atomic_t arrayReallocs;
+#endif
+
 void * Push(Array * arr, void * element) {
     return Insert(arr, element, arr->count);
 }
 
+void * PushN(Array * arr, const void * elements, int count) {
+    InsertRange(arr, elements, arr->count, count);
+    return (u8 *)arr->data + (arr->count - count) * arr->esize;
+}
+
+void AppendArray(Array * arr, const Array * source) {
+    ASSERT(arr->esize == source->esize);
+    PushN(arr, source->data, source->count);
+}
+
 void * Get(Array * arr, int i) {
     if ( i >= arr->count )
         return NULL;
@@ -32,58 +47,104 @@ Array * NewArray(int slots, size_t esize, int resize)
     Array * arr = malloc(sizeof(*arr));
     ASSERT(arr != NULL);
 
+    arr->arena = NULL;
+    arr->data = NULL;
+    arr->slots = 0;
+    arr->count = 0;
+    arr->esize = esize;
+    arr->resize = resize;
+#if DEBUG
+    arr->reallocs = 0;
+#endif
+
     if ( slots != 0 ) {
-        arr->data = malloc(slots * esize);
+        Resize(arr, slots);
     }
-    arr->slots = slots;
-    arr->count = 0;
+
+    return arr;
+}
+
+Array * NewArenaArray(Arena * arena, int slots, size_t esize, int resize)
+{
+    ASSERT(slots > 0 || resize != 0);
+    ASSERT(esize > 0);
+
+    Array * arr = ArenaCalloc(arena, sizeof(*arr));
+    arr->arena = arena;
     arr->esize = esize;
     arr->resize = resize;
 
+    if ( slots != 0 ) {
+        Resize(arr, slots);
+    }
+
     return arr;
 }
 
 void FreeArray(Array * arr) {
     ASSERT(arr);
 
+    if ( arr->arena ) {
+        return;
+    }
+
     if ( arr->data )
         free(arr->data);
     free(arr);
 }
 
-static void Grow(Array * arr)
+/// Grow so there's room for at least `count` elements.
+static void Grow(Array * arr, int count)
 {
-    if ( arr->resize == 0 ) {
+    if ( arr->resize == 0 || count <= arr->slots ) {
         return;
     }
 
+    int slots;
     if ( arr->resize == ARRAY_DOUBLE ) {
-        arr->slots *= 2;
+        slots = arr->slots * 2;
     } else {
-        arr->slots += arr->resize;
+        slots = arr->slots + MAX(arr->resize, arr->slots / 2);
     }
 
-    arr->data = realloc(arr->data, arr->slots * arr->esize);
-    ASSERT(arr->data != NULL);
+    Resize(arr, MAX(slots, count));
 }
 
 void Resize(Array * arr, int slots)
 {
     ASSERT(slots >= 0);
 
+    int oldSlots = arr->slots;
     arr->slots = slots;
 
     if ( slots < arr->count ) {
         arr->count = slots; // We've lots some elements.
     }
 
-    if ( arr->data ) {
-        if ( slots == 0 ) {
-            free(arr->data);
-        } else {
-            arr->data = realloc(arr->data, slots * arr->esize);
-            ASSERT(arr->data != NULL);
-        }
+    if ( arr->arena ) {
+        arr->data = ArenaRealloc(arr->arena,
+                                 arr->data,
+                                 oldSlots * arr->esize,
+                                 slots * arr->esize);
+    } else if ( slots == 0 ) {
+        free(arr->data);
+        arr->data = NULL;
+        return;
+    } else {
+        arr->data = realloc(arr->data, slots * arr->esize);
+        ASSERT(arr->data != NULL);
+    }
+
+#if DEBUG
+    arr->reallocs++;
+    SDL_AtomicIncRef(&arrayReallocs);
+#endif
+}
+
+void Reserve(Array * arr, int slots)
+{
+    if ( slots > arr->slots ) {
+        Resize(arr, slots);
     }
 }
 
@@ -91,7 +152,7 @@ void * Insert(Array * arr, void * element, int i)
 {
     ASSERT(i <= arr->count); // Inserting at arr->count will resize the array.
     if ( arr->count + 1 > arr->slots ) {
-        Grow(arr);
+        Grow(arr, arr->count + 1);
     }
 
     // In case someone tried to add to a full static array.
@@ -109,6 +170,26 @@ void * Insert(Array * arr, void * element, int i)
     return (u8 *)arr->data + (arr->count - 1) * arr->esize;
 }
 
+void InsertRange(Array * arr, const void * elements, int i, int count)
+{
+    ASSERT(i <= arr->count && count >= 0);
+    if ( arr->count + count > arr->slots ) {
+        Grow(arr, arr->count + count);
+    }
+
+    // In case someone tried to add to a full static array.
+    ASSERT(arr->count + count <= arr->slots);
+
+    // Move the latter part of the array right.
+    memmove((u8 *)arr->data + arr->esize * (i + count),
+            (u8 *)arr->data + arr->esize * i,
+            arr->esize * (arr->count - i));
+
+    memcpy((u8 *)arr->data + arr->esize * i, elements, arr->esize * count);
+
+    arr->count += count;
+}
+
 void Remove(Array * arr, int i)
 {
     ASSERT((unsigned)i < (unsigned)arr->count);
@@ -120,6 +201,17 @@ void Remove(Array * arr, int i)
     --arr->count;
 }
 
+void RemoveRange(Array * arr, int i, int count)
+{
+    ASSERT(i >= 0 && count >= 0 && i + count <= arr->count);
+
+    // move the latter part of the array left
+    memmove((u8 *)arr->data + arr->esize * i,
+            (u8 *)arr->data + arr->esize * (i + count),
+            arr->esize * (arr->count - i - count));
+    arr->count -= count;
+}
+
 void FastRemove(Array * arr, int i)
 {
     ASSERT((unsigned)i < (unsigned)arr->count)
@@ -9,6 +9,8 @@
 
 #include <stdlib.h>
 
+struct Arena;
+
 //
 // Declare the iterator just prior to use. e.g.:
 // Point * point
@@ -23,24 +25,42 @@ for(it = arr->data; \
 
 /// Dynamic Array.
 ///
-/// Grows by chosen factor when adding elements if there is no room.
+/// Grows geometrically when adding elements if there is no room: by half
+/// again its size or by `resize` slots, whichever is more, or doubles if
+/// `resize` is `ARRAY_DOUBLE`. An array with a `resize` of 0 never grows.
 /// Does not shrink unless told to.
 typedef struct
 {
     size_t  esize;  // Element size in bytes.
     int     count;  // Current num of elements.
     int     slots;  // Total number of slots allocated.
-    int     resize; // Number of slots added when needing to grow.
+    int     resize; // Minimum number of slots added when needing to grow.
+#if DEBUG
+    int     reallocs; // Number of times `data` has been (re)allocated.
+#endif
 
+    struct Arena * arena; // If not NULL, where the array is allocated.
     void * data;
 } Array;
 
+#if DEBUG
+#include <SDL2/SDL_atomic.h>
+
+/// Total (re)allocations of array data by all arrays, on any thread.
+extern SDL_atomic_t arrayReallocs;
+#endif
+
 /// Allocate an initialize a new `Array`.
 /// - parameter slots: The initialize number of slots to allocate.
 /// - parameter esize: Element size in bytes.
-/// - parameter resize: The number of slots to add when growing the array.
+/// - parameter resize: The minimum number of slots to add when growing the
+///   array, `ARRAY_DOUBLE`, or 0 for a fixed size.
 Array * NewArray(int slots, size_t esize, int resize);
 
+/// Allocate a new `Array` whose storage comes from `arena`. It's released when
+/// the arena is reset; `FreeArray` does nothing.
+Array * NewArenaArray(struct Arena * arena, int slots, size_t esize, int resize);
+
 /// Free array and the array's `data` member.
 void FreeArray(Array * array);
 
@@ -55,9 +75,20 @@ void Clear(Array * array);
 /// - parameter slots: The new number of slots.
 void Resize(Array * array, int slots);
 
+/// Make sure there are at least `slots` slots, so adding elements up to that
+/// count won't reallocate. Also works on arrays that don't grow.
+void Reserve(Array * array, int slots);
+
 /// Push `element` to end of array.
 void * Push(Array * array, void * element);
 
+/// Push `count` elements to the end of array, growing it at most once.
+/// - Returns: A pointer to the first element added.
+void * PushN(Array * array, const void * elements, int count);
+
+/// Push all elements of `source` to the end of `array`.
+void AppendArray(Array * array, const Array * source);
+
 /// Remove and return last element in `out`.
 void Pop(Array * array, void * out);
 
@@ -70,12 +101,18 @@ void * Get(Array * array, int index);
 /// Insert `element` at `index`. Elements are shifted to make room.
 void * Insert(Array * array, void * element, int index);
 
+/// Insert `count` elements at `index`. Elements are shifted once.
+void InsertRange(Array * array, const void * elements, int index, int count);
+
 /// Replace element at `index` with `element`
 void Replace(Array * array, void * element, int index);
 
 /// Remove element at `index`. Elements are shifted.
 void Remove(Array * array, int index);
 
+/// Remove `count` elements starting at `index`. Elements are shifted once.
+void RemoveRange(Array * array, int index, int count);
+
 /// Remove element at `index` quickly by moving the last element in the array
 /// to `index`.
 void FastRemove(Array * arr, int index);
@@ -6,7 +6,10 @@
 // I assume that a grid 8 is used for the maps, so a point will be considered
 // on a line if it is within 8 pixels of it.  The accounts for floating error.
 
-int		cuts; // number of new lines generated by BSP process
+int				cuts; // number of new lines generated by BSP process
+Array			*segstore_i;
+static SDL_atomic_t	cutcount; // cuts, counted by all the building threads
+static SDL_atomic_t	placed; // segs in terminal nodes so far, for progress
 
 
 void	DivlineFromWorldline (divline_t *d, line_t *w)
@@ -158,9 +161,9 @@ line_t * CutLine(line_t * wl, divline_t * bl)
 	NXPoint		intr;
 	int			offset;
 	
-	cuts++;
+	SDL_AtomicIncRef (&cutcount);
 	DivlineFromWorldline (&wld, wl);
-	new_p = malloc (sizeof(line_t));
+	new_p = NB_Alloc (sizeof(line_t));
 	memset (new_p,0,sizeof(*new_p));
 	*new_p = *wl; 
 	
@@ -288,6 +291,63 @@ void ExecuteSplit(Array * lines_i,
 }
 
 
+/// Lists with fewer lines are searched for a partition line on one thread.
+#define PARALLEL_SPLIT_LINES	512
+
+/// The search for a partition line, shared by the threads doing it.
+typedef struct
+{
+	Array			*lines_i;
+	int				step;
+	SDL_atomic_t	bestgrade;	// bestv, readable without the lock
+	SDL_SpinLock	lock;		// guards bestv and besti
+	int				bestv;
+	int				besti;
+} splitsearch_t;
+
+/// Grades the `n`th candidate partition line. Of equal grades, the earliest
+/// candidate wins, so the result doesn't depend on which thread finishes
+/// first and is the one a serial search would find.
+static void EvaluateCandidate (int n, void *data)
+{
+	splitsearch_t	*search = data;
+	int				i, v;
+
+	i = n * search->step;
+	v = EvaluateSplit (search->lines_i, Get(search->lines_i, i),
+					   SDL_AtomicGet(&search->bestgrade));
+	if (v == INT_MAX)
+		return;
+
+	SDL_AtomicLock (&search->lock);
+	if (v < search->bestv || (v == search->bestv && i < search->besti))
+	{
+		search->bestv = v;
+		search->besti = i;
+		SDL_AtomicSet (&search->bestgrade, v);
+	}
+	SDL_AtomicUnlock (&search->lock);
+}
+
+/// Subtrees with fewer lines are built by the thread that split them off.
+#define PARALLEL_SUBTREE_LINES	256
+
+/// A subtree to be built by any worker thread.
+typedef struct
+{
+	Array			*lines_i;
+	bspnode_t		**node_p;	// where to put it
+} subtree_t;
+
+bspnode_t * BSPList(Array * lines_i);
+
+static void BuildSubtree (void *data)
+{
+	subtree_t	*subtree = data;
+
+	*subtree->node_p = BSPList (subtree->lines_i);
+}
+
 static float gray = 1.0f;
 
 /// Takes a storage of lines and recursively partitions the list.
@@ -296,9 +356,10 @@ static float gray = 1.0f;
 bspnode_t * BSPList(Array * lines_i)
 {
 	Array 		    *frontlist_i, *backlist_i;
-	int				c, step;
-	line_t			*line_p, *bestline_p;
-	int				v, bestv;
+	int				c, step, candidates;
+	line_t			*bestline_p;
+	int				bestv;
+	splitsearch_t	search;
 	bspnode_t		*node_p;
 	
 	if ( draw )
@@ -315,28 +376,47 @@ bspnode_t * BSPList(Array * lines_i)
 
     DrawLineStore (lines_i);
 
-	node_p = malloc (sizeof(*node_p));
+	node_p = NB_Alloc (sizeof(*node_p));
 	memset (node_p, 0, sizeof(*node_p));
 
+	c = lines_i->count;
+
+	// a cancelled build's tree is never used, so end it here
+	if (NB_Cancelled ())
+	{
+		node_p->lines_i = lines_i;
+		return node_p;
+	}
+
     //
     // find the best line to partition on
     //
-	c = lines_i->count;
-	bestv = INT_MAX;
-	bestline_p = NULL;
 	step = (c/40)+1;		// set this to 1 for an exhaustive search
 
 research:
-	for ( int i = 0; i < c; i += step )
+	search.lines_i = lines_i;
+	search.step = step;
+	search.lock = 0;
+	search.bestv = INT_MAX;
+	search.besti = -1;
+	SDL_AtomicSet (&search.bestgrade, INT_MAX);
+
+	// Each candidate is graded against the whole list, so big lists are
+	// worth spreading across threads. A grade found on one thread lets the
+	// others give up on worse candidates early.
+	candidates = (c + step - 1) / step;
+	if (c < PARALLEL_SPLIT_LINES)
 	{
-		line_p = Get(lines_i, i);
-		v = EvaluateSplit (lines_i, line_p, bestv);
-		if (v<bestv)
-		{
-			bestv = v;
-			bestline_p = line_p;
-		}
+		for ( int i = 0; i < candidates; i++ )
+			EvaluateCandidate (i, &search);
 	}
+	else
+	{
+		NB_ParallelFor (candidates, EvaluateCandidate, &search);
+	}
+
+	bestv = search.bestv;
+	bestline_p = bestv == INT_MAX ? NULL : Get(lines_i, search.besti);
 	
     //
     // If none of the lines should be split, the remaining lines
@@ -353,6 +433,10 @@ research:
 			goto research;
 		}
 		node_p->lines_i = lines_i;
+
+		// cut segs are placed too, so count them in the total
+		NB_SetProgress (NB_NODES, (float)(SDL_AtomicAdd (&placed, c) + c) /
+						(segstore_i->count + SDL_AtomicGet (&cutcount)));
 		return node_p;
 	}
 	
@@ -360,33 +444,49 @@ research:
     // divide the line list into two nodes along the best split line
     //
 	DivlineFromWorldline (&node_p->divline, bestline_p);
+	node_p->origin = bestline_p->origin;
 
-    frontlist_i = NewArray(0, sizeof(line_t), 1);
-    backlist_i = NewArray(0, sizeof(line_t), 1);
+    // A good split puts about half the lines on each side.
+    frontlist_i = NB_NewArray(c / 2 + 1, sizeof(line_t), 1);
+    backlist_i = NB_NewArray(c / 2 + 1, sizeof(line_t), 1);
 
 	ExecuteSplit (lines_i, bestline_p, frontlist_i, backlist_i);
 
     //
     // recursively divide the lists
     //
-	node_p->side[0] = BSPList(frontlist_i);
-	node_p->side[1] = BSPList(backlist_i);
+	// The two sides share nothing, so when both are big, the front is left
+	// for another thread to take while this one builds the back. A node's
+	// number comes from its place in the tree when it's saved, not from when
+	// it was built, so the lumps are the same either way.
+	if (!draw && MIN(frontlist_i->count, backlist_i->count) >= PARALLEL_SUBTREE_LINES)
+	{
+		taskgroup_t	group = { { 0 } };
+		subtree_t	front = { frontlist_i, &node_p->side[0] };
+
+		NB_Spawn (&group, BuildSubtree, &front);
+		node_p->side[1] = BSPList(backlist_i);
+		NB_Wait (&group);
+	}
+	else
+	{
+		node_p->side[0] = BSPList(frontlist_i);
+		node_p->side[1] = BSPList(backlist_i);
+	}
 	
 	return node_p;
 }
 
 
-Array * segstore_i;
-
 void MakeSegs(void)
 {
-    segstore_i = NewArray(0, sizeof(line_t), 1);
-	
 	int count = linestore_i->count;
 
+    segstore_i = NB_NewArray(count, sizeof(line_t), 1);
+
 	for ( int i = 0; i < count; i++ )
 	{
-        Line * wl = Get(linestore_i, i);
+        worldline_t * wl = Get(linestore_i, i);
 
         line_t li;
 		li.p1 = wl->p1;
@@ -394,6 +494,7 @@ void MakeSegs(void)
 		li.linedef = i;
 		li.side = 0;
 		li.offset = 0;
+		li.origin = segstore_i->count;
 		li.grouped = false;
 
         Push(segstore_i, &li);
@@ -405,6 +506,7 @@ void MakeSegs(void)
 			li.linedef = i;
 			li.side = 1;
 			li.offset = 0;
+			li.origin = segstore_i->count;
 			li.grouped = false;
 
             Push(segstore_i, &li);
@@ -413,15 +515,390 @@ void MakeSegs(void)
 }
 
 
+// -----------------------------------------------------------------------------
+// Rebuilding
+
+/// A node of the last tree built, kept so the next build only has to redo the
+/// parts of it whose segs have changed. The nodes are kept in preorder, so a
+/// node's front child is the one after it, and the segs in a subtree's leaves
+/// are one run of `keptsegs_i`.
+typedef struct
+{
+	divline_t	divline;
+	int			origin;		// the partition's seg, index into keptinput_i
+	int			back;		// index of the back child, or -1 for a leaf
+	int			firstseg;	// the subtree's segs in keptsegs_i
+	int			numsegs;
+} keptnode_t;
+
+static Array	*keptnodes_i;	// keptnode_t[]
+static Array	*keptsegs_i;	// line_t[], the leaves' segs, in tree order
+static Array	*keptinput_i;	// line_t[], segstore_i as it was
+
+// Set up by MatchSegs for the current build.
+static int		*remap;			// kept input seg -> segstore_i index, or -1
+static int		*removedbefore;	// kept segs before each one that are gone
+static int		numremoved;		// kept input segs that are gone
+static int		rebuilt;		// segs handed to BSPList
+
+// New segs are only split along the partitions that are already there, which
+// were picked for the map as it was, so the tree gets worse with each update.
+// It's built over from the map's segs once it has been updated this many
+// times, or once this fraction of its segs have been added or removed since.
+#define MAX_UPDATES			16
+#define MAX_CHANGED_FRACTION	16	// 1/16
+
+static int		numupdates;		// builds since the tree was last built over
+static int		numchanged;		// segs added or removed since then
+
+/// A seg's place in the map, which is all that matters to the tree.
+typedef struct
+{
+	NXPoint		p1, p2;
+	int			index;
+} segkey_t;
+
+static int CompareSegKeys (const void *a, const void *b)
+{
+	const segkey_t	*k1 = a;
+	const segkey_t	*k2 = b;
+
+	if (k1->p1.x != k2->p1.x)
+		return k1->p1.x < k2->p1.x ? -1 : 1;
+	if (k1->p1.y != k2->p1.y)
+		return k1->p1.y < k2->p1.y ? -1 : 1;
+	if (k1->p2.x != k2->p2.x)
+		return k1->p2.x < k2->p2.x ? -1 : 1;
+	if (k1->p2.y != k2->p2.y)
+		return k1->p2.y < k2->p2.y ? -1 : 1;
+	return 0;
+}
+
+static segkey_t * SortedSegKeys (Array *segs_i)
+{
+	segkey_t	*keys;
+	line_t		*seg;
+
+	keys = NB_Alloc ((segs_i->count + 1) * sizeof(*keys));
+	for (int i = 0 ; i < segs_i->count ; i++)
+	{
+		seg = Get(segs_i, i);
+		keys[i].p1 = seg->p1;
+		keys[i].p2 = seg->p2;
+		keys[i].index = i;
+	}
+	qsort (keys, segs_i->count, sizeof(*keys), CompareSegKeys);
+
+	return keys;
+}
+
+/// Pair each of the kept input segs with the same seg in segstore_i. No two
+/// segs run between the same points in the same direction, since overlaid
+/// lines are skipped when the map is loaded.
+///
+/// - Returns: the segs in segstore_i that weren't there before.
+static Array * MatchSegs (void)
+{
+	segkey_t	*oldkeys, *newkeys;
+	int			oldcount, newcount;
+	int			i, j, order;
+	bool		*matched;
+	Array		*added_i;
+	line_t		*seg;
+
+	oldcount = keptinput_i->count;
+	newcount = segstore_i->count;
+	oldkeys = SortedSegKeys (keptinput_i);
+	newkeys = SortedSegKeys (segstore_i);
+
+	remap = NB_Alloc ((oldcount + 1) * sizeof(*remap));
+	matched = NB_Alloc (newcount + 1);
+	memset (matched, 0, newcount + 1);
+
+	numremoved = 0;
+	i = j = 0;
+	while (i < oldcount)
+	{
+		order = j < newcount ? CompareSegKeys (&oldkeys[i], &newkeys[j]) : -1;
+		if (order < 0)
+		{
+			remap[oldkeys[i++].index] = -1;
+			numremoved++;
+		}
+		else if (order > 0)
+			j++;
+		else
+		{
+			remap[oldkeys[i].index] = newkeys[j].index;
+			matched[newkeys[j].index] = true;
+			i++;
+			j++;
+		}
+	}
+
+	removedbefore = NB_Alloc ((keptsegs_i->count + 1) * sizeof(*removedbefore));
+	removedbefore[0] = 0;
+	for (i = 0 ; i < keptsegs_i->count ; i++)
+	{
+		seg = Get(keptsegs_i, i);
+		removedbefore[i + 1] = removedbefore[i] + (remap[seg->origin] == -1);
+	}
+
+	// Segs can be removed as well as added, so count rather than guess.
+	j = 0;
+	for (i = 0 ; i < newcount ; i++)
+		j += !matched[i];
+
+	added_i = NB_NewArray (j, sizeof(line_t), 1);
+	for (i = 0 ; i < newcount ; i++)
+		if (!matched[i])
+			Push(added_i, Get(segstore_i, i));
+
+	return added_i;
+}
+
+/// Copy the kept segs of `kept` that are still in the map to `lines_i`, as
+/// pieces of their segs in segstore_i, whose linedefs may have new numbers.
+static void CopyKeptSegs (keptnode_t *kept, Array *lines_i)
+{
+	line_t		seg, *input;
+
+	for (int i = kept->firstseg ; i < kept->firstseg + kept->numsegs ; i++)
+	{
+		seg = *(line_t *)Get(keptsegs_i, i);
+		if (remap[seg.origin] == -1)
+			continue;
+
+		input = Get(segstore_i, remap[seg.origin]);
+		seg.origin = input->origin;
+		seg.linedef = input->linedef;
+		seg.side = input->side;
+		seg.grouped = false;
+		Push(lines_i, &seg);
+	}
+}
+
+/// Make kept node `n` and its subtree again as they were.
+static bspnode_t * RestoreNode (int n)
+{
+	keptnode_t	*kept;
+	bspnode_t	*node_p;
+	int			c;
+
+	kept = Get(keptnodes_i, n);
+	node_p = NB_Alloc (sizeof(*node_p));
+	memset (node_p, 0, sizeof(*node_p));
+
+	if (kept->back == -1)
+	{
+		node_p->lines_i = NB_NewArray (kept->numsegs, sizeof(line_t), 1);
+		CopyKeptSegs (kept, node_p->lines_i);
+		c = node_p->lines_i->count;
+		NB_SetProgress (NB_NODES, (float)(SDL_AtomicAdd (&placed, c) + c) /
+						(segstore_i->count + SDL_AtomicGet (&cutcount)));
+		return node_p;
+	}
+
+	node_p->divline = kept->divline;
+	node_p->origin = remap[kept->origin];
+	node_p->side[0] = RestoreNode (n + 1);
+	node_p->side[1] = RestoreNode (kept->back);
+
+	return node_p;
+}
+
+/// Build kept node `n` over from its segs that are still in the map and
+/// `added_i`.
+///
+/// - Returns: the new subtree, or NULL if there are no segs for it, or if `n`
+///   is the top of the tree, which is better built from the map's segs than
+///   from pieces of them.
+static bspnode_t * RebuildNode (int n, Array *added_i)
+{
+	keptnode_t	*kept;
+	Array		*lines_i;
+
+	if (n == 0)
+		return NULL;
+
+	kept = Get(keptnodes_i, n);
+	lines_i = NB_NewArray (kept->numsegs + added_i->count, sizeof(line_t), 1);
+	CopyKeptSegs (kept, lines_i);
+	AppendArray (lines_i, added_i);
+
+	if (lines_i->count == 0)
+		return NULL;
+
+	rebuilt += lines_i->count;
+	return BSPList (lines_i);
+}
+
+/// Bring kept node `n` up to date with the map. `added_i` has the new segs
+/// that are on its side of every partition above it.
+///
+/// A subtree none of whose segs have changed is kept as it was. A partition
+/// is kept as long as the seg it was taken from is, and the new segs are
+/// split along it as they would have been. Leaves that have changed, and
+/// subtrees whose partition is gone, are built over.
+///
+/// - Returns: the node, or NULL if there are no segs for it.
+static bspnode_t * UpdateNode (int n, Array *added_i)
+{
+	keptnode_t	*kept;
+	bspnode_t	*front_p, *back_p, *node_p;
+	Array		*frontlist_i, *backlist_i;
+	line_t		*line_p, *newline_p;
+	int			removed;
+
+	kept = Get(keptnodes_i, n);
+	removed = removedbefore[kept->firstseg + kept->numsegs]
+			- removedbefore[kept->firstseg];
+
+	if (added_i->count == 0 && removed == 0)
+		return RestoreNode (n);
+
+	if (kept->back == -1 || remap[kept->origin] == -1)
+		return RebuildNode (n, added_i);
+
+	frontlist_i = NB_NewArray (added_i->count, sizeof(line_t), 1);
+	backlist_i = NB_NewArray (added_i->count, sizeof(line_t), 1);
+
+	FOR_EACH(line_p, added_i)
+	{
+		switch (LineOnSide (line_p, &kept->divline))
+		{
+			case 0:
+				Push(frontlist_i, line_p);
+				break;
+			case 1:
+				Push(backlist_i, line_p);
+				break;
+			case -2:
+				newline_p = CutLine (line_p, &kept->divline);
+				Push(frontlist_i, line_p);
+				Push(backlist_i, newline_p);
+				break;
+		}
+	}
+
+	front_p = UpdateNode (n + 1, frontlist_i);
+	back_p = UpdateNode (kept->back, backlist_i);
+
+	// A partition with nothing left on one side doesn't divide anything.
+	if (front_p == NULL || back_p == NULL)
+		return front_p ? front_p : back_p;
+
+	node_p = NB_Alloc (sizeof(*node_p));
+	memset (node_p, 0, sizeof(*node_p));
+	node_p->divline = kept->divline;
+	node_p->origin = remap[kept->origin];
+	node_p->side[0] = front_p;
+	node_p->side[1] = back_p;
+
+	return node_p;
+}
+
+/// Keep `node_p` and its subtree for the next build.
+static void KeepNode (bspnode_t *node_p)
+{
+	keptnode_t	kept;
+	int			n;
+
+	n = keptnodes_i->count;
+	kept.divline = node_p->divline;
+	kept.origin = node_p->origin;
+	kept.back = -1;
+	kept.firstseg = keptsegs_i->count;
+	Push(keptnodes_i, &kept);
+
+	if (node_p->lines_i)
+	{
+		AppendArray (keptsegs_i, node_p->lines_i);
+	}
+	else
+	{
+		KeepNode (node_p->side[0]);
+		((keptnode_t *)Get(keptnodes_i, n))->back = keptnodes_i->count;
+		KeepNode (node_p->side[1]);
+	}
+
+	((keptnode_t *)Get(keptnodes_i, n))->numsegs = keptsegs_i->count - kept.firstseg;
+}
+
+static void KeepTree (void)
+{
+	if (keptnodes_i == NULL)
+	{
+		keptnodes_i = NewArray (0, sizeof(keptnode_t), ARRAY_DOUBLE);
+		keptsegs_i = NewArray (0, sizeof(line_t), ARRAY_DOUBLE);
+		keptinput_i = NewArray (0, sizeof(line_t), ARRAY_DOUBLE);
+	}
+
+	Clear (keptnodes_i);
+	Clear (keptsegs_i);
+	Clear (keptinput_i);
+
+	KeepNode (startnode);
+	AppendArray (keptinput_i, segstore_i);
+}
+
+
 bspnode_t * startnode;
 
+/// Update the kept tree, unless it has drifted too far from the one a full
+/// build would make. `changed` is set to the segs added or removed since the
+/// last full build, counting this one.
+///
+/// - Returns: the new tree, or NULL if it should be built over.
+static bspnode_t * UpdateTree (int *changed)
+{
+	Array		*added_i;
+
+	if (numupdates >= MAX_UPDATES)
+		return NULL;
+
+	added_i = MatchSegs ();
+	*changed = numchanged + added_i->count + numremoved;
+	if (*changed * MAX_CHANGED_FRACTION > segstore_i->count)
+		return NULL;
+
+	return UpdateNode (0, added_i);
+}
+
 void BuildBSP(void)
 {
+	int		changed = 0;
+	bool	full;
+
 	MakeSegs();
-	cuts = 0;
+	SDL_AtomicSet (&cutcount, 0);
+	SDL_AtomicSet (&placed, 0);
+	rebuilt = 0;
+	startnode = NULL;
 
     if ( draw )
         puts("BSPList");
 
-	startnode = BSPList(segstore_i);
+	// The process is only drawn when the whole tree is built.
+	if (keptnodes_i && !draw)
+		startnode = UpdateTree (&changed);
+
+	full = startnode == NULL;
+	if (full)
+	{
+		rebuilt = segstore_i->count;
+		startnode = BSPList(segstore_i);
+	}
+
+	if (NB_Cancelled ())
+		return;
+
+	numupdates = full ? 0 : numupdates + 1;
+	numchanged = full ? 0 : changed;
+
+	KeepTree ();
+	cuts = keptsegs_i->count - segstore_i->count;
+#if DEBUG
+	printf ("segs rebuilt: %i of %i\n", rebuilt, segstore_i->count);
+#endif
 }
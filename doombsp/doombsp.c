@@ -1,55 +1,306 @@
 // doombsp.c
 #include "doombsp.h"
+#include "arena.h"
 #include "e_editor.h"
+#include "e_journal.h"
 #include "m_map.h"
+#include "p_progress_panel.h"
 #include "p_setup.h"
 
 bool draw;
 
-/// Build the currently loaded map and add/replace in editor.pwad.
-void DoomBSP(void)
+/// All of a build's temporary storage, one arena per worker thread. Reset at
+/// the end of each build.
+static Arena * arenas[NB_MAX_WORKERS];
+
+/// The map as of the last build. The next build's snapshot shares whatever
+/// hasn't changed since.
+static MapSnapshot * snapshot;
+
+/// A lump made by the build. They're all put in the WAD at once when the
+/// build is done, so a cancelled build leaves the WAD as it was.
+typedef struct
 {
-    draw = false; // TODO: use a key modifier to show the build process window.
-    bool replace;
+    char name[9];
+    void * data;
+    u32 size;
+} BuiltLump;
 
-    if ( CheckMap() > 0 ) {
-        printf("Cancelled build due to map errors!\n");
-        return;
-    }
+static Array * builtLumps; // BuiltLump[]
+
+static const struct
+{
+    const char * name;
+    float start; // Fraction of the whole build done when the step starts.
+} steps[NB_NUM_STEPS + 1] =
+{
+    [NB_LOADING]    = { "Loading",  0.00f },
+    [NB_NODES]      = { "Nodes",    0.05f },
+    [NB_SECTORS]    = { "Sectors",  0.60f },
+    [NB_REJECT]     = { "Reject",   0.65f },
+    [NB_BLOCKMAP]   = { "Blockmap", 0.85f },
+    [NB_SAVING]     = { "Saving",   0.90f },
+    [NB_NUM_STEPS]  = { "Done",     1.00f },
+};
+
+// The build thread.
+static SDL_Thread * builder;
+static bool started; // The build hasn't been finished on the main thread.
+static bool succeeded; // Set by the build thread before it returns.
+static SDL_atomic_t building; // The build thread hasn't returned.
+static SDL_atomic_t cancelled;
+static SDL_atomic_t progress; // Thousandths of the build.
+static SDL_atomic_t currentStep;
+
+#if DEBUG
+static int reallocs;
+#endif
+
+void NB_AddLump(const char * name, void * data, u32 size)
+{
+    BuiltLump lump = { .data = data, .size = size };
+
+    strncpy(lump.name, name, 8);
+    Push(builtLumps, &lump);
+}
+
+void * NB_Alloc(size_t size)
+{
+    return ArenaAlloc(arenas[NB_WorkerIndex()], size);
+}
+
+Array * NB_NewArray(int slots, size_t esize, int resize)
+{
+    return NewArenaArray(arenas[NB_WorkerIndex()], slots, esize, resize);
+}
+
+void NB_SetProgress(nbstep_t step, float fraction)
+{
+    float start = steps[step].start;
+    float end = steps[step + 1].start;
+
+    SDL_AtomicSet(&currentStep, step);
+    SDL_AtomicSet(&progress, (start + (end - start) * MIN(fraction, 1.0f)) * 1000);
+}
+
+bool NB_Cancelled(void)
+{
+    return SDL_AtomicGet(&cancelled);
+}
+
+/// Put the built lumps in editor.pwad in the map's place, replacing the old
+/// map's lumps if it's being rebuilt, and save it.
+static void CommitLumps(const char * label)
+{
+    Wad * wad = editor.pwad;
+
+    // Number of the old map's lumps, starting at wad->position, that haven't
+    // been replaced yet.
+    int staleLumps;
 
-    int index = GetIndexOfLumpNamed(editor.pwad, map.label);
+    int index = GetIndexOfLumpNamed(wad, label);
     if ( index == -1 )
     {
-        editor.pwad->position = editor.pwad->lumps->count;
-        replace = false;
+        wad->position = wad->lumps->count;
+        staleLumps = 0;
     }
     else
     {
-        editor.pwad->position = index;
-        replace = true;
+        wad->position = index;
+        staleLumps = ML_COUNT;
     }
 
-    AddLump(editor.pwad, map.label, map.label, 0);
+    BuiltLump * lump;
+    FOR_EACH(lump, builtLumps)
+    {
+        // Overwrite the old map's lump in place when it's the same one, so
+        // rebuilding a map doesn't move every lump after it.
+        if ( staleLumps > 0
+            && SDL_strncasecmp(GetNameOfLump(wad, wad->position),
+                               lump->name,
+                               8) == 0 )
+        {
+            ReplaceLump(wad, wad->position++, lump->data, lump->size);
+            staleLumps--;
+        }
+        else
+        {
+            AddLump(wad, lump->name, lump->data, lump->size);
+        }
+    }
+
+    // Remove any of the old map's lumps that weren't replaced.
+    if ( staleLumps > 0 )
+        RemoveLumps(wad, wad->position, staleLumps);
 
-    NB_LoadMap();
+    SaveWAD(wad);
+}
+
+/// Build `snapshot`. editor.pwad belongs to this thread until it returns.
+static int BuildThread(void * data)
+{
+    (void)data;
+
+    // The editor keeps drawing while this runs.
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    builtLumps = NB_NewArray(ML_COUNT, sizeof(BuiltLump), ML_COUNT);
+    NB_AddLump(snapshot->map.label, NULL, 0);
+
+    NB_SetProgress(NB_LOADING, 0.0f);
+    NB_LoadMap(snapshot);
 	NB_DrawMap();
+
+    NB_SetProgress(NB_NODES, 0.0f);
 	BuildBSP();
-	
-    printf ("segment cuts: %i\n", cuts);
 
-	SaveDoomMap();
-	SaveBlocks();
+    if ( !NB_Cancelled() )
+    {
+#if DEBUG
+        printf ("segment cuts: %i\n", cuts);
+#endif
+        SaveDoomMap();
+    }
+
+    if ( !NB_Cancelled() )
+    {
+        NB_SetProgress(NB_BLOCKMAP, 0.0f);
+        SaveBlocks();
+    }
 
-    if ( replace )
+    // Once the WAD is being changed, it's finished.
+    succeeded = !NB_Cancelled();
+    if ( succeeded )
     {
-        for ( int i = 0; i < ML_COUNT; i++ )
-            RemoveLumpNumber(editor.pwad, editor.pwad->position);
+        NB_SetProgress(NB_SAVING, 0.0f);
+        CommitLumps(snapshot->map.label);
     }
 
-    SaveWAD(editor.pwad);
+    SDL_AtomicSet(&building, 0);
 
-    LoadLevel(); // Update render array data from node builder arrays.
+    return 0;
+}
+
+/// Wait for the build thread and take in what it built.
+static void FinishBuild(void)
+{
+    if ( builder )
+        SDL_WaitThread(builder, NULL);
+    builder = NULL;
+    started = false;
 
-    printf("Node building complete.\n");
+    CloseProgressPanel();
+
+    if ( succeeded )
+    {
+        ResetJournal(snapshot); // The map's saved as of the snapshot.
+        LoadLevel(); // Update render array data from node builder arrays.
+        printf("Node building complete.\n");
+    }
+    else
+    {
+        printf("Node building cancelled.\n");
+    }
+
+#if DEBUG
+    size_t used = 0;
+    size_t reserved = 0;
+    for ( int i = 0; i < NB_NumWorkers(); i++ )
+    {
+        used += arenas[i]->used;
+        reserved += arenas[i]->reserved;
+    }
+    printf("node builder memory: %zu KB peak, %zu KB reserved\n",
+           used / 1024, reserved / 1024);
+    printf("array reallocations: %d\n",
+           SDL_AtomicGet(&arrayReallocs) - reallocs);
+#endif
+
+    for ( int i = 0; i < NB_NumWorkers(); i++ )
+        ResetArena(arenas[i]);
 //    ListDirectory(editor.pwad);
 }
+
+void StartDoomBSP(void)
+{
+    if ( started )
+    {
+        printf("Node building is already in progress.\n");
+        return;
+    }
+
+#if DEBUG
+    reallocs = SDL_AtomicGet(&arrayReallocs);
+#endif
+
+    // TODO: use a key modifier to show the build process window. It can
+    // only be drawn from the main thread.
+    draw = false;
+
+    if ( CheckMap() > 0 ) {
+        printf("Cancelled build due to map errors!\n");
+        return;
+    }
+
+    // The build skips deleted objects, so only compact when there are enough
+    // to be worth renumbering everything after the first one. Otherwise the
+    // snapshot, undo and journal can keep sharing the unchanged chunks.
+    CompactMapIfSparse();
+
+    for ( int i = 0; i < NB_NumWorkers(); i++ )
+        if ( arenas[i] == NULL )
+            arenas[i] = NewArena(1024 * 1024);
+
+    // The build reads only this, so the map can be edited while it runs.
+    MapSnapshot * previous = snapshot;
+    snapshot = TakeMapSnapshot(previous);
+    if ( previous )
+        FreeMapSnapshot(previous);
+
+    started = true;
+    succeeded = false;
+    SDL_AtomicSet(&building, 1);
+    SDL_AtomicSet(&cancelled, 0);
+    NB_SetProgress(NB_LOADING, 0.0f);
+    OpenProgressPanel("Building Nodes", CancelDoomBSP);
+
+    builder = SDL_CreateThread(BuildThread, "build", NULL);
+    if ( builder == NULL )
+    {
+        printf("Error: could not start build thread (%s)\n", SDL_GetError());
+        BuildThread(NULL);
+    }
+}
+
+void UpdateDoomBSP(void)
+{
+    if ( !started )
+        return;
+
+    if ( SDL_AtomicGet(&building) )
+    {
+        SetProgress(SDL_AtomicGet(&progress) / 1000.0f,
+                    steps[SDL_AtomicGet(&currentStep)].name);
+        return;
+    }
+
+    FinishBuild();
+}
+
+void CancelDoomBSP(void)
+{
+    SDL_AtomicSet(&cancelled, 1);
+}
+
+void WaitForDoomBSP(void)
+{
+    if ( started )
+        FinishBuild();
+}
+
+void DoomBSP(void)
+{
+    WaitForDoomBSP();
+    StartDoomBSP();
+    WaitForDoomBSP();
+}
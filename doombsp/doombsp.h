@@ -6,6 +6,7 @@
 #include "doomdata.h"
 #include "array.h"
 #include "next.h"
+#include "m_snapshot.h"
 
 #include <math.h>
 #include <stdbool.h>
@@ -16,6 +17,17 @@
 // -----------------------------------------------------------------------------
 // doombsp Types
 
+/// A map line as the node builder sees it: its points in NeXT coordinates,
+/// and its sides, which the editor keeps apart from the rest of the line.
+typedef struct
+{
+	NXPoint		p1, p2;
+	int			flags;
+	int			special;
+	int			tag;
+	Sidedef		sides[NUM_SIDES];
+} worldline_t;
+
 typedef	struct
 {
 	NXPoint	pt;
@@ -27,6 +39,7 @@ typedef struct bspstruct_s
 {
 	Array *				    lines_i;		// if non NULL, the node is
 	divline_t				divline;		// terminal and has no children
+	int						origin;			// seg the divline was taken from
 	float					bbox[4];
 	struct bspstruct_s		*side[2];
 } bspnode_t;
@@ -37,6 +50,7 @@ typedef struct
     int			linedef; // index into linestore_i
     int         side; // 0 = front, 1 = back
     int         offset; // End of the segment.
+    int         origin; // index into segstore_i of the seg this was cut from
 	bool		grouped; // internal error check
 } line_t; // This is really a segment!
 
@@ -46,16 +60,96 @@ typedef struct
 
 extern bool draw;
 
+/// Steps of a build, for reporting progress.
+typedef enum
+{
+	NB_LOADING,
+	NB_NODES,
+	NB_SECTORS,
+	NB_REJECT,
+	NB_BLOCKMAP,
+	NB_SAVING,
+	NB_NUM_STEPS
+} nbstep_t;
+
+/// Add a map lump to the build's output. When the build is done, its lumps
+/// replace the old map's in editor.pwad. `data` must last until then.
+void NB_AddLump(const char * name, void * data, u32 size);
+
+/// Report how far along the build is, as the `fraction` of `step` that's
+/// done. Any thread may call it.
+void NB_SetProgress(nbstep_t step, float fraction);
+
+/// Whether the build has been cancelled. Long steps check it and stop early.
+bool NB_Cancelled(void);
+
+/// Allocate memory that lasts until the end of the current build. Each worker
+/// thread allocates from its own arena.
+void * NB_Alloc(size_t size);
+
+/// Make an array that lasts until the end of the current build. Only the
+/// thread that made it may add to it.
+Array * NB_NewArray(int slots, size_t esize, int resize);
+
+
+// -----------------------------------------------------------------------------
+// workers
+
+/// Most threads that work on a build, including the one running it.
+#define NB_MAX_WORKERS 16
+
+/// Tasks that are waited for together.
+typedef struct
+{
+	SDL_atomic_t	pending;	// spawned but not finished
+} taskgroup_t;
+
+/// Number of threads that work on a build, including the one running it.
+int NB_NumWorkers(void);
+
+/// Index, from 0 to `NB_NumWorkers() - 1`, of the calling thread. The thread
+/// running the build is 0.
+int NB_WorkerIndex(void);
+
+/// Queue `func(data)` to be run by this or any other worker thread.
+void NB_Spawn(taskgroup_t * group, void (* func)(void * data), void * data);
+
+/// Run queued tasks until every task spawned in `group` has finished.
+void NB_Wait(taskgroup_t * group);
+
+/// Call `func(i, data)` for each `i` in [0, `count`), spread across the
+/// worker threads and the calling thread. Indices are handed out in
+/// increasing order; returns when all calls have finished.
+void NB_ParallelFor(int count, void (* func)(int i, void * data), void * data);
+
+/// Stop the worker threads. They're started again by the next build.
+void NB_StopWorkers(void);
+
+
+// -----------------------------------------------------------------------------
+// uniqueindex
+
+typedef struct uniqueindex_s uniqueindex_t;
+
+/// Make an index of `array`'s elements, with room for `count` before it has to
+/// grow. It lasts until the end of the current build.
+uniqueindex_t * NB_NewUniqueIndex(Array * array, int count);
+
+/// Add `element` to the index's array unless an identical one is there.
+/// - Returns: the index of the identical element, or of the one added.
+int NB_AddUnique(uniqueindex_t * index, void * element);
+
 
 // -----------------------------------------------------------------------------
 // doomload
 // TODO: remove doomload.c
 extern	Array	*linestore_i, *thingstore_i;
 
-/// Populate node builder arrays `linestore_i` and `thingstore_i`, skipping
-/// any invalid data. Coordinates are translated from SDL back to NeXT.
+/// Populate node builder arrays `linestore_i` and `thingstore_i` from
+/// `snapshot`, skipping any invalid data. Coordinates are translated from SDL
+/// back to NeXT.
 /// - Author: Thomas Foster
-void NB_LoadMap(void);
+void NB_LoadMap(const MapSnapshot * snapshot);
 
 
 // -----------------------------------------------------------------------------
@@ -73,7 +167,7 @@ void EraseWindow (void);
 void NB_DrawMap (void);
 
 /// Draws all of the lines in the given storage object.
-/// - note: This handles arrays of both `line_t` and `Line`!
+/// - note: This handles arrays of both `line_t` and `worldline_t`!
 void DrawLineStore (Array * lines_i);
 void DrawDivLine (divline_t *div);
 void DrawLineDef (maplinedef_t *ld);
@@ -85,6 +179,9 @@ void DrawLineDef (maplinedef_t *ld);
 extern int cuts; // number of new lines generated by BSP process
 extern bspnode_t * startnode;
 
+/// Build `startnode` from `linestore_i`. The tree is kept afterward, and the
+/// next build rebuilds only the subtrees whose segs have changed since,
+/// unless the partition at the top of the tree is gone.
 void BuildBSP (void);
 void DivlineFromWorldline (divline_t *d, line_t *w);
 int	PointOnSide (NXPoint *p, divline_t *l);
@@ -126,6 +223,23 @@ void OutputConnections (void);
 // -----------------------------------------------------------------------------
 // doombsp
 
+/// Build the current map on another thread and add or replace it in
+/// editor.pwad. The map can be edited meanwhile; the build uses a snapshot of
+/// it. Progress is shown in the progress panel.
+void StartDoomBSP(void);
+
+/// Update the progress panel and, when the build is done, take in its
+/// results. Call once per frame.
+void UpdateDoomBSP(void);
+
+/// Stop the build without changing editor.pwad, unless it's already being
+/// saved. Doesn't wait for the build thread.
+void CancelDoomBSP(void);
+
+/// Wait for the build thread to finish and take in its results.
+void WaitForDoomBSP(void);
+
+/// Build the current map and wait for it.
 void DoomBSP(void);
 
 #endif /* DOOMBSP_H */
@@ -1,6 +1,7 @@
 // doomload.m
 #include "doombsp.h"
 #include "m_map.h"
+#include "m_snapshot.h"
 #include <limits.h>
 
 // TF: Stores map.lines and map.things, filtered, and coordinates converted
@@ -39,10 +40,10 @@ void BBoxFromPoints (bbox_t *box, NXPoint *p1, NXPoint *p2)
 }
 
 /// Check to see if the line is colinear and overlapping any previous lines.
-bool LineOverlaid(Line * line)
+bool LineOverlaid(worldline_t * line)
 {
 	int		    j, count;
-	Line	    *scan;
+	worldline_t	*scan;
 	divline_t	wl;
 	bbox_t		linebox, scanbox;
 	
@@ -75,46 +76,55 @@ bool LineOverlaid(Line * line)
 	return false;
 }
 
-void NB_LoadMap(void)
+void NB_LoadMap(const MapSnapshot * snapshot)
 {
-    linestore_i = NewArray(map.lines->count, sizeof(Line), 0);
+    const SnapshotArray * lines = &snapshot->lines;
+    const SnapshotArray * things = &snapshot->things;
 
-    Vertex * vertices = map.vertices->data;
-    Line * lines = map.lines->data;
-    Line * line = lines;
+    linestore_i = NB_NewArray(lines->count, sizeof(worldline_t), 0);
 
-    for ( int i = 0; i < map.lines->count; i++, line++ )
+    for ( int i = 0; i < lines->count; i++ )
     {
-        if ( line->deleted )
+        const Line * mapLine = GetSnapshotElement(lines, i);
+        if ( mapLine->deleted )
             continue;
-        line->p1.x =  vertices[line->v1].origin.x;
-        line->p1.y = -vertices[line->v1].origin.y; // SDL to NeXT
-        line->p2.x =  vertices[line->v2].origin.x;
-        line->p2.y = -vertices[line->v2].origin.y; // SDL to NeXT
 
-        if ( line->p1.x == line->p2.x && line->p1.y == line->p2.y )
+        const LineSides * sides = GetSnapshotElement(&snapshot->lineSides, i);
+        const Vertex * v1 = GetSnapshotElement(&snapshot->vertices, mapLine->v1);
+        const Vertex * v2 = GetSnapshotElement(&snapshot->vertices, mapLine->v2);
+
+        worldline_t line =
+        {
+            .p1 = { v1->origin.x, -v1->origin.y }, // SDL to NeXT
+            .p2 = { v2->origin.x, -v2->origin.y },
+            .flags = mapLine->flags,
+            .special = mapLine->special,
+            .tag = mapLine->tag,
+        };
+
+        memcpy(line.sides, sides->sides, sizeof(line.sides));
+
+        if ( line.p1.x == line.p2.x && line.p1.y == line.p2.y )
         {
             printf("Warning: Line %d has length of 0 and will be skipped\n", i);
             continue;
         }
 
-        if ( LineOverlaid(line) )
+        if ( LineOverlaid(&line) )
         {
             printf("Warning: Line %d if overlaid with another and will"
                    "be skipped.\n", i);
             continue;
         }
 
-        Push(linestore_i, line);
+        Push(linestore_i, &line);
     }
 
-    thingstore_i = NewArray(map.things->count, sizeof(Thing), 0);
-
-    Thing * things = map.things->data;
-    Thing * thing = things;
+    thingstore_i = NB_NewArray(things->count, sizeof(Thing), 0);
 
-    for ( int i = 0; i < map.things->count; i++, thing++ )
+    for ( int i = 0; i < things->count; i++ )
     {
+        const Thing * thing = GetSnapshotElement(things, i);
         if ( thing->deleted )
             continue;
         
@@ -66,7 +66,7 @@ void NB_Refresh(int delayMS)
 void BoundLineStore(Array * lines_i, NXRect * r)
 {
 	int				i, c;
-	Line		    *line_p;
+	worldline_t	*line_p;
 	
 	c = lines_i->count;
 	if (!c)
@@ -97,7 +97,7 @@ void NB_DrawLine(float x1, float y1, float x2, float y2)
 void DrawLineStore(Array * lines_i)
 {
 	int				i,c;
-	Line		    *line_p;
+	worldline_t	*line_p;
 	
 	if ( !draw )
 		return;
@@ -12,7 +12,7 @@ float	orgx, orgy;
 float		xl, xh, yl, yh;
 
 
-bool LineContact(Line * wl)
+bool LineContact(worldline_t * wl)
 {
 	NXPoint		*p1, *p2, pt1, pt2;
 	float		lxl, lxh, lyl, lyh;
@@ -83,7 +83,7 @@ bool LineContact(Line * wl)
 void GenerateBlockList(int x, int y)
 {
 	NXRect		r;
-	Line	    *wl;
+	worldline_t	*wl;
 	int			count, i;
 	
 	*data_p++ = 0;		// leave space for thing links
@@ -197,6 +197,6 @@ void SaveBlocks (void)
 	
 	printf ("blockmap: (%i, %i) = %i\n",blockwidth, blockheight, len);
 	 
-    AddLump(editor.pwad, "blockmap", datalist, len);
+    NB_AddLump("blockmap", datalist, len);
 }
 
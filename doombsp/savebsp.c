@@ -21,7 +21,7 @@ void WriteStorage(char * name, Array * store, int esize)
 	int count = store->count;
 	int len = esize * count;
 
-    AddLump(editor.pwad, name, store->data, len);
+    NB_AddLump(name, store->data, len);
 	printf("%s (%i): %i\n", name, count, len);
 }
 
@@ -176,27 +176,17 @@ void OutputNodes (void)
 // -----------------------------------------------------------------------------
 // Processing
 
+static uniqueindex_t * vertexindex; // of mapvertexstore_i
+
 /// Returns the vertex number, adding a new vertex if needed.
 int UniqueVertex (int x, int y)
 {
-	int				i, count;
-	mapvertex_t		mv, *mvp;
+	mapvertex_t		mv;
 	
 	mv.x = x;
 	mv.y = y;
 	
-    // see if an identical vertex already exists
-	count = mapvertexstore_i->count;
-	mvp = Get(mapvertexstore_i, 0);
-	for (i=0 ; i<count ; i++, mvp++)
-    {
-        if (mvp->x == mv.x && mvp->y == mv.y)
-            return i;
-    }
-
-    Push(mapvertexstore_i, &mv);
-	
-	return count;	
+	return NB_AddUnique (vertexindex, &mv);
 }
 
 
@@ -320,9 +310,9 @@ void ProcessNodes (void)
 {
 	short	worldbounds_[4];
 
-    subsecstore_i = NewArray(0, sizeof(mapsubsector_t), 1);
-    maplinestore_i = NewArray(0, sizeof(mapseg_t), 1);
-    nodestore_i = NewArray(0, sizeof(mapnode_t), 1);
+    subsecstore_i = NB_NewArray(0, sizeof(mapsubsector_t), 1);
+    maplinestore_i = NB_NewArray(0, sizeof(mapseg_t), 1);
+    nodestore_i = NB_NewArray(0, sizeof(mapnode_t), 1);
 
 	ProcessNode (startnode, worldbounds_);
 }
@@ -333,9 +323,9 @@ void ProcessThings (void)
 	mapthing_t		mt;
 	int				count;
 	
-    mapthingstore_i = NewArray(0, sizeof(mapthing_t), 1);
-
 	count = thingstore_i->count;
+    mapthingstore_i = NB_NewArray(count, sizeof(mapthing_t), 1);
+
 	wt = Get(thingstore_i, 0);
 
 	while ( count-- )
@@ -372,13 +362,15 @@ void ProcessLineSideDefs (void)
 {
 	int				i, count;
 	maplinedef_t	ld;
-	Line		    *wl;
+	worldline_t	    *wl;
 	
-    mapvertexstore_i = NewArray(0, sizeof(mapvertex_t), 1);
-    ldefstore_i = NewArray(0, sizeof(maplinedef_t), 1);
-    sdefstore_i = NewArray(0, sizeof(mapsidedef_t), 1);
+    mapvertexstore_i = NB_NewArray(0, sizeof(mapvertex_t), 1);
 
 	count = linestore_i->count;
+	vertexindex = NB_NewUniqueIndex(mapvertexstore_i, count);
+
+    ldefstore_i = NB_NewArray(count, sizeof(maplinedef_t), 1);
+    sdefstore_i = NB_NewArray(count, sizeof(mapsidedef_t), 1);
 
 	for (i=0 ; i<count ; i++)
 	{
@@ -403,12 +395,17 @@ void ProcessLineSideDefs (void)
 
 void SaveDoomMap (void)
 {
+	NB_SetProgress(NB_SECTORS, 0.0f);
 	BuildSectordefs();
 	ProcessThings();
 	ProcessLineSideDefs();
 	ProcessNodes();
 	ProcessSectors();
+
+	NB_SetProgress(NB_REJECT, 0.0f);
 	ProcessConnections();
+	if (NB_Cancelled())
+		return;
 	
     // all processing is complete, write everything out
 
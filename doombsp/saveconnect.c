@@ -221,6 +221,13 @@ void BuildConnections (void)
 	bbox[0] = secboxes;
 	for (i=0 ; i<numsectors_-1 ; i++, bbox[0]++)
 	{
+		if (NB_Cancelled())
+			return;
+
+		// the pairs left to check shrink with the square of the sectors left
+		NB_SetProgress (NB_REJECT, 1.0f - (float)(numsectors_-i)*(numsectors_-i)
+						/ ((float)numsectors_*numsectors_));
+
 		bbox[1] = bbox[0] + 1;
 		if (bbox[0]->xh - bbox[0]->xl < 64 || bbox[0]->yh - bbox[0]->yl < 64)
 		{	// don't bother with small sectors (stairs, doorways, etc)
@@ -360,11 +367,13 @@ void BuildBlockingChains (void)
 	bchain_t	bch;
 	int			cx, cy;
 	
-	used = alloca (numblines*sizeof (*used));
+	// A chain of all the lines has a point more than there are lines. The
+	// build thread's stack may be small, so these don't go on it.
+	used = NB_Alloc (numblines*sizeof (*used));
 	memset (used,0,numblines*sizeof (*used));
-	temppoints = alloca (numblines*sizeof (*temppoints));
+	temppoints = NB_Alloc ((numblines+1)*sizeof (*temppoints));
 	
-    chains_i = NewArray(0, sizeof(bchain_t), 1);
+    chains_i = NB_NewArray(0, sizeof(bchain_t), 1);
 
 	li1 = blines;
 	for (i=0 ; i<numblines ; i++, li1++)
@@ -407,7 +416,7 @@ void BuildBlockingChains (void)
 		
         // save the block chain
 		bch.numpoints = (int)(pt_p - temppoints);
-		bch.points = malloc (bch.numpoints*sizeof(*bch.points));
+		bch.points = NB_Alloc (bch.numpoints*sizeof(*bch.points));
 		memcpy (bch.points, temppoints, bch.numpoints*sizeof(*bch.points));
         Push(chains_i, &bch);
         //DrawBChain (&bch);
@@ -422,7 +431,7 @@ void ProcessConnections (void)
 	int		        i, s, wlcount, count;
 	bbox_t *        secbox;
 	Array *         lines;
-	Line *          wl;
+	worldline_t *   wl;
 	mapvertex_t *   vt;
 	maplinedef_t *  p;
 	mapsidedef_t *  sd;
@@ -432,10 +441,10 @@ void ProcessConnections (void)
 	numsectors_ = secstore_i->count;
 	wlcount = linestore_i->count;
 
-	connections = malloc (numsectors_*numsectors_+8); // allow rounding to bytes
-	memset (connections, 0, numsectors_*numsectors_);
+	connections = NB_Alloc (numsectors_*numsectors_+8); // allow rounding to bytes
+	memset (connections, 0, numsectors_*numsectors_+8);
 	
-	secboxes = secbox = malloc (numsectors_*sizeof(bbox_t));
+	secboxes = secbox = NB_Alloc (numsectors_*sizeof(bbox_t));
 	for (i=0 ; i<numsectors_ ; i++, secbox++)
 		ClearBBox (secbox);
 
@@ -462,7 +471,7 @@ void ProcessConnections (void)
     //
     // make a list of only the solid lines
     //
-    lines = NewArray(0, sizeof(bline), 1);
+    lines = NB_NewArray(0, sizeof(bline), 1);
 
 	for ( i=0 ; i<wlcount ; wl++,i++)
 	{
@@ -501,7 +510,7 @@ void OutputConnections (void)
 	
 	cons = (char *)connections;
 	bytes = (numsectors_*numsectors_+7)/8;
-	bits = malloc(bytes);
+	bits = NB_Alloc(bytes);
 	
 	for (i=0 ; i<bytes ; i++)
 	{
@@ -509,6 +518,6 @@ void OutputConnections (void)
 		cons +=8;
 	}
 
-    AddLump(editor.pwad, "reject", bits, bytes);
+    NB_AddLump("reject", bits, bytes);
     printf ("reject: %i\n",bytes);
 }
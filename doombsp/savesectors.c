@@ -3,6 +3,7 @@
 #include "doombsp.h"
 
 Array		*secdefstore_i;
+static uniqueindex_t	*secdefindex; // of secdefstore_i
 
 #define		MAXVERTEX		8192
 #define		MAXTOUCHSECS	16
@@ -71,8 +72,7 @@ void RecursiveGroupSubsector (int ssnum)
 /// - Returns: the sector number, adding a new sector if needed.
 int UniqueSector(SectorDef * def)
 {
-	int		i, count;
-	mapsector_t		ms, *msp;
+	mapsector_t		ms;
 	
 	ms.floorheight = def->floorHeight;
 	ms.ceilingheight = def->ceilingHeight;
@@ -82,19 +82,7 @@ int UniqueSector(SectorDef * def)
 	ms.special = def->special;
 	ms.tag = def->tag;
 	
-    // see if an identical sector already exists
-
-	count = secdefstore_i->count;
-	for (i=0 ; i<count ; i++)
-    {
-        msp = Get(secdefstore_i, i);
-        if ( memcmp(msp, &ms, sizeof(ms)) == 0 )
-            return i;
-    }
-
-    Push(secdefstore_i, &ms);
-	
-	return count;	
+	return NB_AddUnique (secdefindex, &ms);
 }
 
 void AddSubsectorToVertex (int subnum, int vertex)
@@ -113,14 +101,15 @@ void AddSubsectorToVertex (int subnum, int vertex)
 void BuildSectordefs (void)
 {
 	int				i;
-	Line		    *wl;
+	worldline_t	*wl;
 	int				count;
 	
     //
     // build sectordef list
     //
 
-    secdefstore_i = NewArray(0, sizeof(mapsector_t), 1);
+    secdefstore_i = NB_NewArray(0, sizeof(mapsector_t), 1);
+    secdefindex = NB_NewUniqueIndex(secdefstore_i, 0);
 	
 	count = linestore_i->count;
 	wl= Get(linestore_i, 0);
@@ -171,7 +160,7 @@ void ProcessSectors (void)
     // recursively build final sectors
     //
 
-    secstore_i = NewArray(0, sizeof(mapsector_t), 1);
+    secstore_i = NB_NewArray(0, sizeof(mapsector_t), 1);
 	
 	buildsector = 0;
 	if (draw)
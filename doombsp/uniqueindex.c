@@ -0,0 +1,96 @@
+//
+//  uniqueindex.c
+//  de
+//
+//  An open addressing hash table of the elements of an array, for adding an
+//  element only if an identical one isn't already there. Elements are
+//  compared byte for byte, so they mustn't have padding.
+//
+
+#include "doombsp.h"
+
+#define EMPTY_SLOT (-1)
+
+struct uniqueindex_s
+{
+    Array * array;
+    int * slots; // Index in `array`, or EMPTY_SLOT.
+    int numSlots; // Always a power of two.
+};
+
+static u32 HashElement(const void * element, size_t size)
+{
+    const u8 * bytes = element;
+    u32 hash = 2166136261u; // FNV-1a
+
+    for ( size_t i = 0; i < size; i++ )
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    return hash ^ (hash >> 16);
+}
+
+/// Returns the slot that holds `element`'s index, or the empty slot where it
+/// would go.
+static int * FindSlot(const uniqueindex_t * index, const void * element)
+{
+    Array * array = index->array;
+    u32 mask = index->numSlots - 1;
+    u32 i = HashElement(element, array->esize) & mask;
+
+    while ( 1 )
+    {
+        int * slot = &index->slots[i];
+
+        if (   *slot == EMPTY_SLOT
+            || memcmp(Get(array, *slot), element, array->esize) == 0 )
+            return slot;
+
+        i = (i + 1) & mask;
+    }
+}
+
+/// Make room for at least `count` elements at under half full, and enter the
+/// array's elements again.
+static void ResizeIndex(uniqueindex_t * index, int count)
+{
+    int numSlots = 16;
+    while ( numSlots < count * 2 )
+        numSlots *= 2;
+
+    // The old slots go with the rest of the build's memory.
+    index->slots = NB_Alloc(numSlots * sizeof(*index->slots));
+    index->numSlots = numSlots;
+
+    for ( int i = 0; i < numSlots; i++ )
+        index->slots[i] = EMPTY_SLOT;
+
+    for ( int i = 0; i < index->array->count; i++ )
+        *FindSlot(index, Get(index->array, i)) = i;
+}
+
+uniqueindex_t * NB_NewUniqueIndex(Array * array, int count)
+{
+    uniqueindex_t * index = NB_Alloc(sizeof(*index));
+
+    index->array = array;
+    ResizeIndex(index, MAX(count, array->count));
+
+    return index;
+}
+
+int NB_AddUnique(uniqueindex_t * index, void * element)
+{
+    Array * array = index->array;
+
+    if ( (array->count + 1) * 2 > index->numSlots )
+        ResizeIndex(index, array->count + 1);
+
+    int * slot = FindSlot(index, element);
+    if ( *slot == EMPTY_SLOT )
+    {
+        *slot = array->count;
+        Push(array, element);
+    }
+
+    return *slot;
+}
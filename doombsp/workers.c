@@ -0,0 +1,284 @@
+//
+//  workers.c
+//  de
+//
+//  A pool of threads that help the node builder with work that can be split
+//  into independent tasks. The pool is started with the first build and the
+//  threads sleep between builds.
+//
+//  Each thread has its own queue of tasks it has spawned. A thread runs its
+//  newest task first and, when its queue is empty, steals the oldest task
+//  from another thread's queue. The oldest tasks are the biggest pieces of
+//  the work, so a steal is rarely needed twice for the same piece.
+//
+
+#include "doombsp.h"
+
+#define MAX_QUEUED_TASKS 1024 // per thread
+
+typedef struct
+{
+    void (* func)(void * data);
+    void * data;
+    taskgroup_t * group;
+} Task;
+
+typedef struct
+{
+    SDL_SpinLock lock;
+    int head; // The oldest task, the next one stolen.
+    int tail; // One past the newest task, the next one the owner runs.
+    Task tasks[MAX_QUEUED_TASKS];
+} TaskQueue;
+
+static TaskQueue queues[NB_MAX_WORKERS];
+static SDL_Thread * threads[NB_MAX_WORKERS];
+static int numWorkers; // Including the thread running the build. 0 = not started.
+
+/// Index of this thread's queue. The thread running the build is 0.
+static _Thread_local int self;
+
+// Threads with nothing to do wait for `wake`.
+static SDL_mutex * lock;
+static SDL_cond * wake;
+static SDL_atomic_t queued; // Tasks in all queues.
+static SDL_atomic_t sleeping;
+static bool quit;
+
+#pragma mark - Queues
+
+static bool PushTask(TaskQueue * queue, const Task * task)
+{
+    bool pushed = false;
+
+    SDL_AtomicLock(&queue->lock);
+    if ( queue->tail - queue->head < MAX_QUEUED_TASKS )
+    {
+        queue->tasks[queue->tail++ % MAX_QUEUED_TASKS] = *task;
+        pushed = true;
+    }
+    SDL_AtomicUnlock(&queue->lock);
+
+    return pushed;
+}
+
+/// Take the newest (`newest`) or oldest task from `queue`.
+static bool TakeTask(TaskQueue * queue, Task * task, bool newest)
+{
+    bool taken = false;
+
+    SDL_AtomicLock(&queue->lock);
+    if ( queue->head < queue->tail )
+    {
+        if ( newest )
+            *task = queue->tasks[--queue->tail % MAX_QUEUED_TASKS];
+        else
+            *task = queue->tasks[queue->head++ % MAX_QUEUED_TASKS];
+
+        if ( queue->head == queue->tail )
+            queue->head = queue->tail = 0;
+
+        taken = true;
+    }
+    SDL_AtomicUnlock(&queue->lock);
+
+    return taken;
+}
+
+/// Take a task from this thread's queue, or steal one from another's.
+static bool FindTask(Task * task)
+{
+    if ( SDL_AtomicGet(&queued) == 0 )
+        return false;
+
+    bool found = TakeTask(&queues[self], task, true);
+
+    for ( int i = 1; i < numWorkers && !found; i++ )
+        found = TakeTask(&queues[(self + i) % numWorkers], task, false);
+
+    if ( found )
+        SDL_AtomicAdd(&queued, -1);
+
+    return found;
+}
+
+static void WakeSleepers(void)
+{
+    if ( SDL_AtomicGet(&sleeping) > 0 )
+    {
+        SDL_LockMutex(lock);
+        SDL_CondBroadcast(wake);
+        SDL_UnlockMutex(lock);
+    }
+}
+
+static void RunTask(const Task * task)
+{
+    task->func(task->data);
+
+    if ( SDL_AtomicAdd(&task->group->pending, -1) == 1 )
+        WakeSleepers(); // Someone may be waiting for this group.
+}
+
+#pragma mark - Threads
+
+static int WorkerThread(void * data)
+{
+    self = (int)(intptr_t)data;
+    Task task;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    while ( true )
+    {
+        if ( FindTask(&task) )
+        {
+            RunTask(&task);
+            continue;
+        }
+
+        SDL_LockMutex(lock);
+        SDL_AtomicIncRef(&sleeping);
+        while ( SDL_AtomicGet(&queued) == 0 && !quit )
+            SDL_CondWait(wake, lock);
+        SDL_AtomicAdd(&sleeping, -1);
+        bool done = quit;
+        SDL_UnlockMutex(lock);
+
+        if ( done )
+            break;
+    }
+
+    return 0;
+}
+
+static void StartWorkers(void)
+{
+    numWorkers = SDL_GetCPUCount();
+    numWorkers = SDL_clamp(numWorkers, 1, NB_MAX_WORKERS);
+
+    if ( numWorkers == 1 )
+        return;
+
+    lock = SDL_CreateMutex();
+    wake = SDL_CreateCond();
+    quit = false;
+
+    for ( int i = 1; i < numWorkers; i++ )
+    {
+        threads[i] = SDL_CreateThread(WorkerThread,
+                                      "node builder",
+                                      (void *)(intptr_t)i);
+        if ( threads[i] == NULL )
+        {
+            printf("Error: could not start node builder thread (%s)\n",
+                   SDL_GetError());
+            numWorkers = i;
+            break;
+        }
+    }
+}
+
+int NB_NumWorkers(void)
+{
+    if ( numWorkers == 0 )
+        StartWorkers();
+
+    return numWorkers;
+}
+
+int NB_WorkerIndex(void)
+{
+    return self;
+}
+
+void NB_StopWorkers(void)
+{
+    if ( numWorkers > 1 )
+    {
+        SDL_LockMutex(lock);
+        quit = true;
+        SDL_CondBroadcast(wake);
+        SDL_UnlockMutex(lock);
+
+        for ( int i = 1; i < numWorkers; i++ )
+            SDL_WaitThread(threads[i], NULL);
+
+        SDL_DestroyCond(wake);
+        SDL_DestroyMutex(lock);
+    }
+
+    numWorkers = 0;
+}
+
+#pragma mark - Tasks
+
+void NB_Spawn(taskgroup_t * group, void (* func)(void *), void * data)
+{
+    Task task = { func, data, group };
+
+    SDL_AtomicIncRef(&group->pending);
+
+    // With no one to share with, or no room to queue it, just do it now.
+    if ( NB_NumWorkers() == 1 || !PushTask(&queues[self], &task) )
+    {
+        RunTask(&task);
+        return;
+    }
+
+    SDL_AtomicIncRef(&queued);
+    WakeSleepers();
+}
+
+void NB_Wait(taskgroup_t * group)
+{
+    Task task;
+
+    // Help out until the group is done, rather than sit idle.
+    while ( SDL_AtomicGet(&group->pending) > 0 )
+    {
+        if ( FindTask(&task) )
+        {
+            RunTask(&task);
+            continue;
+        }
+
+        SDL_LockMutex(lock);
+        SDL_AtomicIncRef(&sleeping);
+        while ( SDL_AtomicGet(&queued) == 0
+               && SDL_AtomicGet(&group->pending) > 0 )
+            SDL_CondWait(wake, lock);
+        SDL_AtomicAdd(&sleeping, -1);
+        SDL_UnlockMutex(lock);
+    }
+}
+
+typedef struct
+{
+    void (* func)(int i, void * data);
+    void * data;
+    int count;
+    SDL_atomic_t next; // The next index to hand out.
+} ParallelJob;
+
+static void RunParallelJob(void * data)
+{
+    ParallelJob * job = data;
+    int i;
+
+    while ( (i = SDL_AtomicAdd(&job->next, 1)) < job->count )
+        job->func(i, job->data);
+}
+
+void NB_ParallelFor(int count, void (* func)(int, void *), void * data)
+{
+    ParallelJob job = { func, data, count, { 0 } };
+    taskgroup_t group = { { 0 } };
+
+    int helpers = MIN(NB_NumWorkers(), count) - 1;
+    for ( int i = 0; i < helpers; i++ )
+        NB_Spawn(&group, RunParallelJob, &job);
+
+    RunParallelJob(&job);
+    NB_Wait(&group);
+}
@@ -14,6 +14,7 @@
 #include "e_map_view.h"
 #include "e_geometry.h"
 #include "e_undo.h"
+#include "e_journal.h"
 #include "e_defaults.h"
 #include "e_sector.h"
 
@@ -21,6 +22,8 @@
 #include "g_thingdef.h"
 
 #include "m_map.h"
+#include "m_grid.h"
+#include "m_adjacency.h"
 
 #include "p_panel.h"
 #include "p_stack.h"
@@ -99,6 +102,13 @@ static struct
     bool multi;
 } createLine;
 
+typedef struct
+{
+    Line line;
+    Sidedef sides[NUM_SIDES];
+    SDL_Point p1, p2;
+} LineCopy;
+
 static Array * lineCopies;
 static Array * thingCopies;
 
@@ -197,6 +207,9 @@ void DragSelectedObjects(float dt)
         SaveUndoState();
     }
 
+    if ( dx == 0 && dy == 0 )
+        return;
+
     Vertex * vertices = map.vertices->data;
     for ( int i = 0; i < map.vertices->count; i++ )
     {
@@ -206,17 +219,28 @@ void DragSelectedObjects(float dt)
         {
             vertices[i].origin.x += dx;
             vertices[i].origin.y += dy;
+            UpdateMapGrid(MAP_VERTICES, i);
 
             map.boundsDirty = true;
         }
     }
 
+    // Re-index lines that moved with their vertices.
+    for ( int i = 0; i < map.lines->count; i++ )
+    {
+        Line * line = Get(map.lines, i);
+        if ( !line->deleted
+            && (vertices[line->v1].selected || vertices[line->v2].selected) )
+            UpdateMapGrid(MAP_LINES, i);
+    }
+
     Thing * things = map.things->data;
     for ( int i = 0; i < map.things->count; i++ )
     {
         if ( things[i].selected ) {
             things[i].origin.x += dx;
             things[i].origin.y += dy;
+            UpdateMapGrid(MAP_THINGS, i);
             map.boundsDirty = true;
         }
     }
@@ -224,42 +248,77 @@ void DragSelectedObjects(float dt)
     previousDragPoint = current;
 }
 
-void HandleDragObjectsEvent(const SDL_Event * event)
+typedef struct
 {
-    if ( event->type == SDL_MOUSEBUTTONUP
-        && event->button.button == SDL_BUTTON_LEFT )
-    {
-        editorState = ES_EDIT;
-        MergeVertices();
+    int line;
+    SDL_Point point;
+} LineSplit;
 
-        // If dragging a vertex onto a line, split it.
+static int CompareLineSplits(const void * a, const void * b)
+{
+    return ((const LineSplit *)a)->line - ((const LineSplit *)b)->line;
+}
 
-        Array * selectedVertices = NewArray(0, sizeof(Vertex), 1);
-        Vertex * v;
+/// Split any lines that selected vertices were dropped onto, each at every
+/// vertex on it.
+static void SplitLinesUnderSelectedVertices(void)
+{
+    Array * candidates = NewArray(16, sizeof(int), 16);
+    Array * splits = NewArray(0, sizeof(LineSplit), ARRAY_DOUBLE);
 
-        for ( int i = 0; i < map.vertices->count; i++ )
-        {
-            v = Get(map.vertices, i);
-            if ( v->selected && !v->removed )
-                Push(selectedVertices, v);
-        }
+    for ( int i = 0; i < map.vertices->count; i++ )
+    {
+        Vertex * v = Get(map.vertices, i);
+        if ( !v->selected || v->removed )
+            continue;
 
-        for ( int i = 0; i < map.lines->count; i++ )
-        {
-            Line * l = Get(map.lines, i);
+        SDL_Rect rect = { v->origin.x, v->origin.y, 0, 0 };
+        QueryMapGrid(MAP_LINES, &rect, candidates);
 
-            for ( int j = 0; j < selectedVertices->count; j++ )
+        int * index;
+        FOR_EACH(index, candidates)
+        {
+            if ( VertexOnLine(v, Get(map.lines, *index)) )
             {
-                v = Get(selectedVertices, j);
-                if ( VertexOnLine(v, l) )
-                {
-                    SDL_Point vertexGridPoint = GridPoint(&v->origin);
-                    SplitLine(l, &vertexGridPoint);
-                }
+                LineSplit split = { .line = *index, .point = v->origin };
+                Push(splits, &split);
             }
         }
+    }
+
+    qsort(splits->data, splits->count, sizeof(LineSplit), CompareLineSplits);
+
+    // Split each line once, at all the points on it.
+    Array * points = NewArray(16, sizeof(SDL_Point), 16);
+    LineSplit * split = splits->data;
+    LineSplit * end = split + splits->count;
+
+    while ( split < end )
+    {
+        int index = split->line;
+        Clear(points);
+
+        for ( ; split < end && split->line == index; split++ )
+            Push(points, &split->point);
+
+        SplitLineAtPoints(index, points->data, points->count);
+    }
+
+    FreeArray(points);
+    FreeArray(splits);
+    FreeArray(candidates);
+}
+
+void HandleDragObjectsEvent(const SDL_Event * event)
+{
+    if ( event->type == SDL_MOUSEBUTTONUP
+        && event->button.button == SDL_BUTTON_LEFT )
+    {
+        editorState = ES_EDIT;
+        MergeVertices();
 
-        FreeArray(selectedVertices);
+        // If dragging a vertex onto a line, split it.
+        SplitLinesUnderSelectedVertices();
     }
 }
 
@@ -267,6 +326,9 @@ void HandleDragObjectsEvent(const SDL_Event * event)
 
 void SelectObjectsInSelectionBox(void)
 {
+    Array * found = NewArray(64, sizeof(int), 64);
+    int * i;
+
     SDL_Rect vertexCheckRect = {
         .x = selectionBox.x - VERTEX_DRAW_SIZE / 2,
         .y = selectionBox.y - VERTEX_DRAW_SIZE / 2,
@@ -274,18 +336,19 @@ void SelectObjectsInSelectionBox(void)
         .h = selectionBox.h + VERTEX_DRAW_SIZE
     };
 
-    Vertex * vertex = map.vertices->data;
-    for ( int i = 0; i < map.vertices->count; i++, vertex++ )
+    QueryMapGrid(MAP_VERTICES, &vertexCheckRect, found);
+    FOR_EACH(i, found)
     {
-        if ( vertex->removed ) continue;
+        Vertex * vertex = Get(map.vertices, *i);
         if ( SDL_PointInRect(&vertex->origin, &vertexCheckRect) )
             vertex->selected = true;
     }
 
     Vertex * vertices = map.vertices->data;
-    Line * line = map.lines->data;
-    for ( int i = 0; i < map.lines->count; i++, line++ )
+    QueryMapGrid(MAP_LINES, &selectionBox, found);
+    FOR_EACH(i, found)
     {
+        Line * line = Get(map.lines, *i);
         Vertex * v1 = &vertices[line->v1];
         Vertex * v2 = &vertices[line->v2];
         if ( LineInRect(&v1->origin, &v2->origin, &selectionBox) ) {
@@ -302,13 +365,16 @@ void SelectObjectsInSelectionBox(void)
         .h = selectionBox.h + THING_DRAW_SIZE
     };
 
-    Thing * thing = map.things->data;
-    for ( int i = 0; i < map.things->count; i++, thing++ )
+    QueryMapGrid(MAP_THINGS, &thingCheckRect, found);
+    FOR_EACH(i, found)
     {
+        Thing * thing = Get(map.things, *i);
         if ( SDL_PointInRect(&thing->origin, &thingCheckRect) ) {
             thing->selected = true;
         }
     }
+
+    FreeArray(found);
 }
 
 void HandleDragBoxEvent(const SDL_Event * event)
@@ -362,7 +428,8 @@ void HandleDragViewEvent(const SDL_Event * event)
 
 bool GetSectorOnSide(Line * line, int side)
 {
-    line->sides[side].sectorDef = GetBaseSectordef();
+    int index = LineIndex(line);
+    GetLineSides(index)[side].sectorDef = GetBaseSectordef();
     DeselectAllLines();
     SDL_FPoint fillPoint = LineNormal(line, side == 0 ? 1.0f : -1.0f);
     
@@ -372,10 +439,9 @@ bool GetSectorOnSide(Line * line, int side)
     Line * check;
     FOR_EACH(check, map.lines)
     {
-        if ( check->selected )
+        if ( check->selected && !check->deleted )
         {
-            int selectedSide = check->selected - 1;
-            line->sides[side].sectorDef = check->sides[selectedSide].sectorDef;
+            GetLineSides(index)[side].sectorDef = SelectedSide(check)->sectorDef;
             return true;
         }
     }
@@ -390,12 +456,14 @@ void CreateLine(void)
     SaveUndoState();
 
     Line * line = NewLine(&baseLine,
+                          baseSides,
                           &createLine.start,
                           &createLine.end,
                           true);
+    Sidedef * lineSides = GetLineSides(LineIndex(line));
 
     // Find the sector on the front.
-    line->sides[SIDE_FRONT].sectorDef = GetBaseSectordef();
+    lineSides[SIDE_FRONT].sectorDef = GetBaseSectordef();
     DeselectAllLines();
     fillPoint = LineNormal(line, 1.0f);
     if ( SelectSector(&(SDL_Point){ fillPoint.x, fillPoint.y }) )
@@ -404,12 +472,12 @@ void CreateLine(void)
         {
             Line * check = Get(map.lines, i);
             if ( check->selected && !check->deleted )
-                line->sides[0].sectorDef = check->sides[check->selected - 1].sectorDef;
+                lineSides[0].sectorDef = SelectedSide(check)->sectorDef;
         }
     }
 
     // Find the sector on the back, and set to two-sided if present.
-    line->sides[1].sectorDef = GetBaseSectordef();
+    lineSides[1].sectorDef = GetBaseSectordef();
     DeselectAllLines();
     fillPoint = LineNormal(line, -1.0f);
     if ( SelectSector(&(SDL_Point){ fillPoint.x, fillPoint.y}) )
@@ -419,7 +487,7 @@ void CreateLine(void)
             Line * check = Get(map.lines, i);
             if ( check->selected && !check->deleted )
             {
-                line->sides[1].sectorDef = check->sides[check->selected - 1].sectorDef;
+                lineSides[1].sectorDef = SelectedSide(check)->sectorDef;
                 line->flags |= ML_TWOSIDED;
             }
         }
@@ -477,6 +545,8 @@ void UpdateNewLine(float dt)
 
 void SeparateVertices(void)
 {
+    Array * incident = NewArray(16, sizeof(int), 16);
+
     for ( int i = 0; i < map.vertices->count; i++ )
     {
         Vertex * v = Get(map.vertices, i);
@@ -485,31 +555,31 @@ void SeparateVertices(void)
         if ( v->removed || v->referenceCount < 2 || !v->selected )
             continue;
 
-        for ( int j = 0; j < map.lines->count; j++ )
-        {
-            Line * l = Get(map.lines, j);
-
-            if ( l->deleted )
-                continue;
+        GetVertexLines(i, incident);
 
+        int * index;
+        FOR_EACH(index, incident)
+        {
             if ( v->referenceCount == 1 )
                 break; // The vertex has been fully separated.
 
-            if ( l->v1 == i || l->v2 == i )
-            {
-                Vertex new = { .origin = v->origin, .referenceCount = 1 };
-                Push(map.vertices, &new);
+            SDL_Point origin = v->origin;
+            int newVertex = NewVertex(&origin, false);
 
-                if ( l->v1 == i )
-                    l->v1 = map.vertices->count - 1;
-                else if ( l->v2 == i )
-                    l->v2 = map.vertices->count - 1;
+            Line * l = Get(map.lines, *index);
+            if ( l->v1 == i )
+                l->v1 = newVertex;
+            else if ( l->v2 == i )
+                l->v2 = newVertex;
 
-                v = Get(map.vertices, i);
-                v->referenceCount--;
-            }
+            UpdateVertexLines(*index);
+
+            v = Get(map.vertices, i);
+            v->referenceCount--;
         }
     }
+
+    FreeArray(incident);
 }
 
 void SelectLine(int index, Side side)
@@ -525,7 +595,7 @@ void SelectLine(int index, Side side)
     printf("- two-sided: %s\n", lines[index].flags & ML_TWOSIDED ? "yes" : "no");
     for ( int i = 0; i < 2; i++ )
     {
-        Sidedef * s = &lines[index].sides[i];
+        Sidedef * s = &GetLineSides(index)[i];
         printf("- side %d:\n", i);
         printf("    floor: %s\n", s->sectorDef.floorFlat);
         printf("    ceiling: %s\n", s->sectorDef.ceilingFlat);
@@ -546,14 +616,19 @@ void SelectLine(int index, Side side)
 
 SelectionType SelectObject(bool openPanel)
 {
+    static Array * found;
+    if ( found == NULL )
+        found = NewArray(16, sizeof(int), 16);
+
     SDL_Rect clickRect = MakeCenteredRect(&worldMouse, SELECTION_SIZE / scale);
 
     if ( !openPanel ) // Don't bother checking vertices when right-clicking.
     {
-        Vertex * vertex = map.vertices->data;
-        for ( int i = 0; i < map.vertices->count; i++, vertex++ )
+        QueryMapGrid(MAP_VERTICES, &clickRect, found);
+        for ( int j = 0; j < found->count; j++ )
         {
-            if ( vertex->removed ) continue;
+            int i = *(int *)Get(found, j);
+            Vertex * vertex = Get(map.vertices, i);
 
             if ( SDL_PointInRect(&vertex->origin, &clickRect) )
             {
@@ -579,9 +654,12 @@ SelectionType SelectObject(bool openPanel)
     }
 
     Vertex * vertices = map.vertices->data;
-    Line * line = map.lines->data;
-    for ( int i = 0; i < map.lines->count; i++, line++ )
+    QueryMapGrid(MAP_LINES, &clickRect, found);
+    for ( int j = 0; j < found->count; j++ )
     {
+        int i = *(int *)Get(found, j);
+        Line * line = Get(map.lines, i);
+
         if ( LineInRect(&vertices[line->v1].origin,
                         &vertices[line->v2].origin,
                         &clickRect) )
@@ -608,9 +686,11 @@ SelectionType SelectObject(bool openPanel)
     }
 
     clickRect = MakeCenteredRect(&worldMouse, THING_DRAW_SIZE);
-    Thing * thing = map.things->data;
-    for ( int i = 0; i < map.things->count; i++, thing++ )
+    QueryMapGrid(MAP_THINGS, &clickRect, found);
+    for ( int j = 0; j < found->count; j++ )
     {
+        Thing * thing = Get(map.things, *(int *)Get(found, j));
+
         if ( SDL_PointInRect(&thing->origin, &clickRect) )
         {
             if ( !SHIFT_DOWN && !thing->selected )
@@ -663,15 +743,12 @@ void CopySelectedObjects(void)
 
         if ( line->selected )
         {
-            Line copy = *line;
+            LineCopy copy = { .line = *line };
+            memcpy(copy.sides, GetLineSides(i), sizeof(copy.sides));
 
             // Store the line's position, in case vertices change in between
-            // now and pasting. Well, we've already got an NXPoint's so just
-            // use that.
-            SDL_Point p1, p2;
-            GetLinePoints(i, &p1, &p2);
-            copy.p1 = (NXPoint){ p1.x, p1.y };
-            copy.p2 = (NXPoint){ p2.x, p2.y };
+            // now and pasting.
+            GetLinePoints(i, &copy.p1, &copy.p2);
 
             Push(lineCopies, &copy);
         }
@@ -696,10 +773,10 @@ void PasteObjects(void)
     // TODO: find the bbox of all selected objects, paste at mouse location.
     for ( int i = 0; i < lineCopies->count; i++ )
     {
-        Line * line = Get(lineCopies, i);
-        SDL_Point p1 = { line->p1.x + 16, line->p1.y + 16 };
-        SDL_Point p2 = { line->p2.x + 16, line->p2.y + 16 };
-        Line * new = NewLine(line, &p1, &p2, false);
+        LineCopy * copy = Get(lineCopies, i);
+        SDL_Point p1 = { copy->p1.x + 16, copy->p1.y + 16 };
+        SDL_Point p2 = { copy->p2.x + 16, copy->p2.y + 16 };
+        Line * new = NewLine(&copy->line, copy->sides, &p1, &p2, false);
 
         Vertex * vertices = map.vertices->data;
         vertices[new->v1].selected = true;
@@ -714,10 +791,21 @@ void PasteObjects(void)
     }
 }
 
+/// Remove vertex `index` if no lines use it anymore.
+static void RemoveIfUnused(int index, Array * incident)
+{
+    GetVertexLines(index, incident);
+
+    if ( incident->count == 0 )
+        RemoveVertex(index);
+}
+
 void DeleteSelectedObjects(void)
 {
     SaveUndoState();
 
+    Array * incident = NewArray(16, sizeof(int), 16);
+
     Vertex * vertices = map.vertices->data;
 
     for ( int i = 0; i < map.lines->count; i++ )
@@ -729,13 +817,11 @@ void DeleteSelectedObjects(void)
         // Remove lines with both vertices selected.
         if ( line->selected && v1->selected && v2->selected )
         {
-            line->deleted = true;
+            DeleteLine(i);
 
             // Remove vertices if this is the last line that uses them.
-            if ( --v1->referenceCount <= 0 )
-                v1->removed = true;
-            if ( --v2->referenceCount <= 0 )
-                v2->removed = true;
+            RemoveIfUnused(line->v1, incident);
+            RemoveIfUnused(line->v2, incident);
         }
     }
 
@@ -743,10 +829,12 @@ void DeleteSelectedObjects(void)
     {
         Thing * thing = Get(map.things, i);
         if ( thing->selected )
-            thing->deleted = true;
+            DeleteThing(i);
     }
 
+    FreeArray(incident);
     DeselectAllObjects();
+    CompactMapIfSparse();
 }
 
 /// Autoscroll to the center of selected object(s)
@@ -875,7 +963,7 @@ void ProcessEditorEvent(const SDL_Event * event)
 
                 case SDLK_s:
                     if ( COMMAND )
-                        DoomBSP();
+                        StartDoomBSP();
                     else
                         scrollDirection |= SCROLLING_DOWN;
                     break;
@@ -1234,7 +1322,7 @@ void InitEditor(void)
 #endif
 
 
-    lineCopies = NewArray(0, sizeof(Line), 16);
+    lineCopies = NewArray(0, sizeof(LineCopy), 16);
     thingCopies = NewArray(0, sizeof(Thing), 16);
 }
 
@@ -1358,6 +1446,8 @@ void EditorFrame(float dt)
 #endif
 
     StateUpdate(dt);
+    UpdateDoomBSP();
+    UpdateJournal();
 
 //    R_RenderPlayerView(&viewPlayer);
 //    I_FinishUpdate(); // Actually render the live view.
@@ -1423,6 +1513,10 @@ void EditorLoop(void)
 
 void CleanupEditor(void)
 {
+    // A build in progress is a save the user asked for, so let it finish.
+    WaitForDoomBSP();
+    CloseJournal();
+    NB_StopWorkers();
     FreeWad(editor.pwad);
     FreeWad(editor.iwad);
     FreePanel(&texturePanel);
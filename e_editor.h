@@ -26,7 +26,7 @@ typedef enum
 typedef struct
 {
     Game game;  // which game the level is for.
-    Wad * iwad; // aka "resource" WAD.
+    Wad * iwad; // aka "resource" WAD: the IWAD with any PWADs merged over it.
     Wad * pwad; // user-created WAD being edited.
     
     int numSelectedLines;
@@ -0,0 +1,497 @@
+//
+//  e_journal.c
+//  de
+//
+//  The journal is a header followed by records. Chunk records hold map
+//  snapshot chunks that changed since the previous commit, and a commit record
+//  marks the end of a complete map. Each record is checksummed, so a torn
+//  write at the end is ignored and recovery stops at the last whole commit.
+//
+
+#include "e_journal.h"
+#include "m_map.h"
+#include "m_grid.h"
+#include "m_adjacency.h"
+#include "m_snapshot.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define JOURNAL_ID "DEJ2"
+#define JOURNAL_BUFFER_SIZE (64 * 1024)
+#define MAX_RECORD_SIZE (1024 * 1024)
+#define NUM_JOURNAL_ARRAYS 4
+
+typedef enum
+{
+    RECORD_CHUNK,
+    RECORD_COMMIT,
+} RecordType;
+
+typedef struct
+{
+    u32 type;
+    u32 array; // Chunk records: vertices, lines, line sides, or things.
+    u32 first; // Chunk records: index of the first element.
+    u32 count; // Chunk records: number of elements.
+    u32 size; // Bytes of data after the record.
+    u32 checksum; // Of the fields above and the data.
+} JournalRecord;
+
+typedef struct
+{
+    u32 counts[NUM_JOURNAL_ARRAYS];
+    u32 esizes[NUM_JOURNAL_ARRAYS];
+} JournalCommit;
+
+static char path[512];
+
+// Main thread.
+static MapSnapshot * base; // The last snapshot taken.
+static u32 lastJournalTime;
+
+// Shared with the writer thread.
+static SDL_Thread * writer;
+static SDL_mutex * lock;
+static SDL_cond * wake;
+static MapSnapshot * pending; // The newest snapshot not yet written.
+static bool resetPending;
+static bool quit;
+
+// Writer thread.
+static FILE * file;
+static long fileSize;
+static long snapshotSize; // Size of a whole map, the last time one was written.
+
+static const SnapshotArray * JournalArray(const MapSnapshot * snapshot, int i)
+{
+    switch ( i )
+    {
+        case 0: return &snapshot->vertices;
+        case 1: return &snapshot->lines;
+        case 2: return &snapshot->lineSides;
+        default: return &snapshot->things;
+    }
+}
+
+static Array * MapArray(int i)
+{
+    switch ( i )
+    {
+        case 0: return map.vertices;
+        case 1: return map.lines;
+        case 2: return map.lineSides;
+        default: return map.things;
+    }
+}
+
+static u32 Checksum(const JournalRecord * record, const void * data)
+{
+    u32 hash = 2166136261u; // FNV-1a
+
+    const u8 * bytes = (const u8 *)record;
+    for ( size_t i = 0; i < offsetof(JournalRecord, checksum); i++ )
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    bytes = data;
+    for ( u32 i = 0; i < record->size; i++ )
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    return hash;
+}
+
+#pragma mark - Writing
+
+static void WriteRecord(JournalRecord record, const void * data)
+{
+    record.checksum = Checksum(&record, data);
+    fwrite(&record, sizeof(record), 1, file);
+    fwrite(data, record.size, 1, file);
+    fileSize += sizeof(record) + record.size;
+}
+
+/// Write the chunks of `snapshot` that aren't in `written`, which may be NULL,
+/// then a commit.
+static void WriteSnapshot(const MapSnapshot * snapshot, const MapSnapshot * written)
+{
+    JournalCommit commit;
+    long start = fileSize;
+
+    for ( int i = 0; i < NUM_JOURNAL_ARRAYS; i++ )
+    {
+        const SnapshotArray * array = JournalArray(snapshot, i);
+        const SnapshotArray * old = written ? JournalArray(written, i) : NULL;
+        int numChunks = NumSnapshotChunks(array);
+        int numOld = old ? NumSnapshotChunks(old) : 0;
+
+        for ( int c = 0; c < numChunks; c++ )
+        {
+            SnapshotChunk * chunk = array->chunks[c];
+            if ( c < numOld && old->chunks[c] == chunk )
+                continue;
+
+            JournalRecord record = {
+                .type = RECORD_CHUNK,
+                .array = i,
+                .first = c * array->chunkLength,
+                .count = chunk->count,
+                .size = chunk->count * (u32)array->esize,
+            };
+            WriteRecord(record, chunk->data);
+        }
+
+        commit.counts[i] = array->count;
+        commit.esizes[i] = (u32)array->esize;
+    }
+
+    JournalRecord record = { .type = RECORD_COMMIT, .size = sizeof(commit) };
+    WriteRecord(record, &commit);
+
+    fflush(file);
+    if ( ferror(file) )
+    {
+        printf("Error: could not write journal '%s'\n", path);
+        clearerr(file);
+    }
+
+    if ( written == NULL )
+        snapshotSize = fileSize - start;
+}
+
+static bool StartFile(const char * filePath)
+{
+    if ( file )
+        fclose(file);
+
+    file = fopen(filePath, "wb");
+    if ( file == NULL )
+    {
+        printf("Error: could not create journal '%s'\n", filePath);
+        return false;
+    }
+
+    setvbuf(file, NULL, _IOFBF, JOURNAL_BUFFER_SIZE);
+    fwrite(JOURNAL_ID, 4, 1, file);
+    fileSize = 4;
+
+    return true;
+}
+
+/// Replace the journal with one that has only `snapshot` in it, once it's
+/// mostly old changes.
+static void CompactFile(const MapSnapshot * snapshot)
+{
+    char tempPath[sizeof(path) + 4];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+
+    if ( !StartFile(tempPath) )
+        return;
+
+    WriteSnapshot(snapshot, NULL);
+    fclose(file);
+    file = NULL;
+
+#ifdef _WIN32
+    remove(path); // Windows won't rename over an existing file.
+#endif
+    rename(tempPath, path);
+
+    file = fopen(path, "ab");
+    if ( file )
+        setvbuf(file, NULL, _IOFBF, JOURNAL_BUFFER_SIZE);
+}
+
+static int WriterThread(void * data)
+{
+    (void)data;
+    MapSnapshot * written = NULL;
+
+    SDL_LockMutex(lock);
+    while ( true )
+    {
+        while ( pending == NULL && !resetPending && !quit )
+            SDL_CondWait(wake, lock);
+
+        if ( quit )
+            break;
+
+        MapSnapshot * snapshot = pending;
+        bool reset = resetPending;
+        pending = NULL;
+        resetPending = false;
+        SDL_UnlockMutex(lock);
+
+        if ( reset )
+        {
+            // With a map to write, the old journal is kept until the new one
+            // has it, in case of a crash in between.
+            if ( snapshot )
+                CompactFile(snapshot);
+            else
+                StartFile(path);
+
+            if ( written )
+                FreeMapSnapshot(written);
+            written = NULL;
+        }
+        else if ( snapshot && file )
+        {
+            if ( written && fileSize > 4 * snapshotSize + MAX_RECORD_SIZE )
+                CompactFile(snapshot);
+            else
+                WriteSnapshot(snapshot, written);
+        }
+
+        if ( snapshot )
+        {
+            if ( written )
+                FreeMapSnapshot(written);
+            written = snapshot;
+        }
+
+        SDL_LockMutex(lock);
+    }
+    SDL_UnlockMutex(lock);
+
+    if ( written )
+        FreeMapSnapshot(written);
+
+    return 0;
+}
+
+#pragma mark - Recovery
+
+static bool ReadRecord(FILE * stream, JournalRecord * record, Array * buffer)
+{
+    if ( fread(record, sizeof(*record), 1, stream) != 1 )
+        return false;
+
+    if ( record->size > MAX_RECORD_SIZE )
+        return false;
+
+    Reserve(buffer, record->size);
+    if ( fread(buffer->data, 1, record->size, stream) != record->size )
+        return false;
+
+    return record->checksum == Checksum(record, buffer->data);
+}
+
+static bool ApplyChunk(const JournalRecord * record, const void * data)
+{
+    if ( record->array >= NUM_JOURNAL_ARRAYS )
+        return false;
+
+    Array * array = MapArray(record->array);
+    int first = record->first;
+    int count = record->count;
+
+    if ( first > array->count || count * array->esize != record->size )
+        return false;
+
+    // Overwrite what's already there and add the rest.
+    int overlap = MIN(count, array->count - first);
+    memcpy((u8 *)array->data + first * array->esize, data, overlap * array->esize);
+    PushN(array, (const u8 *)data + overlap * array->esize, count - overlap);
+
+    return true;
+}
+
+static void TruncateArray(Array * array, int count)
+{
+    if ( array->count > count )
+        RemoveRange(array, count, array->count - count);
+}
+
+/// Restore the map from the last complete commit in the journal.
+static bool Recover(void)
+{
+    FILE * stream = fopen(path, "rb");
+    if ( stream == NULL )
+        return false;
+
+    char id[4];
+    Array * buffer = NewArray(SNAPSHOT_CHUNK_SIZE, 1, ARRAY_DOUBLE);
+    JournalRecord record;
+    JournalCommit commit;
+    long end = 0;
+
+    if ( fread(id, sizeof(id), 1, stream) == 1 && strncmp(id, JOURNAL_ID, 4) == 0 )
+    {
+        // Find where the last complete commit ends.
+        while ( ReadRecord(stream, &record, buffer) )
+        {
+            if ( record.type == RECORD_COMMIT && record.size == sizeof(commit) )
+            {
+                memcpy(&commit, buffer->data, sizeof(commit));
+                end = ftell(stream);
+            }
+        }
+    }
+
+    bool recovered = false;
+
+    if ( end == 0 )
+        goto done; // Nothing was changed.
+
+    if ( commit.esizes[0] != sizeof(Vertex)
+        || commit.esizes[1] != sizeof(Line)
+        || commit.esizes[2] != sizeof(LineSides)
+        || commit.esizes[3] != sizeof(Thing) )
+    {
+        printf("Error: journal '%s' is from a different version of de\n", path);
+        goto done;
+    }
+
+    for ( int i = 0; i < NUM_JOURNAL_ARRAYS; i++ )
+        Clear(MapArray(i));
+
+    fseek(stream, sizeof(id), SEEK_SET);
+    while ( ftell(stream) < end && ReadRecord(stream, &record, buffer) )
+    {
+        if ( record.type == RECORD_CHUNK )
+        {
+            if ( !ApplyChunk(&record, buffer->data) )
+                break;
+        }
+        else if ( record.type == RECORD_COMMIT )
+        {
+            memcpy(&commit, buffer->data, sizeof(commit));
+            for ( int i = 0; i < NUM_JOURNAL_ARRAYS; i++ )
+                TruncateArray(MapArray(i), commit.counts[i]);
+        }
+    }
+
+    recovered = ftell(stream) == end;
+    if ( !recovered )
+        printf("Error: journal '%s' is damaged\n", path);
+
+    InvalidateMapGrid();
+    InvalidateVertexLines();
+    InvalidateFreeSlots();
+    map.boundsDirty = true;
+    GetMapBounds();
+
+done:
+    FreeArray(buffer);
+    fclose(stream);
+
+    return recovered;
+}
+
+#pragma mark -
+
+bool OpenJournal(const char * wadPath)
+{
+    snprintf(path, sizeof(path), "%s.%s.journal", wadPath, map.label);
+
+    u32 start = SDL_GetTicks();
+    bool recovered = Recover();
+    if ( recovered )
+    {
+        printf("Recovered unsaved changes to %s from '%s' (%d ms)\n",
+               map.label, path, SDL_GetTicks() - start);
+    }
+
+    lock = SDL_CreateMutex();
+    wake = SDL_CreateCond();
+    quit = false;
+    base = TakeMapSnapshot(NULL);
+
+    // The journal starts over. A recovered map is still unsaved, so it's
+    // written to the new journal right away.
+    resetPending = true;
+    pending = recovered ? CopyMapSnapshot(base) : NULL;
+    writer = SDL_CreateThread(WriterThread, "journal", NULL);
+
+    lastJournalTime = SDL_GetTicks();
+
+    return recovered;
+}
+
+/// Whether every chunk of `a` is shared with `b`.
+static bool SnapshotsShared(const MapSnapshot * a, const MapSnapshot * b)
+{
+    for ( int i = 0; i < NUM_JOURNAL_ARRAYS; i++ )
+    {
+        const SnapshotArray * aa = JournalArray(a, i);
+        const SnapshotArray * bb = JournalArray(b, i);
+
+        if ( aa->count != bb->count )
+            return false;
+
+        for ( int c = 0; c < NumSnapshotChunks(aa); c++ )
+            if ( aa->chunks[c] != bb->chunks[c] )
+                return false;
+    }
+
+    return true;
+}
+
+void UpdateJournal(void)
+{
+    if ( base == NULL || SDL_GetTicks() - lastJournalTime < JOURNAL_INTERVAL_MS )
+        return;
+
+    lastJournalTime = SDL_GetTicks();
+
+    MapSnapshot * snapshot = TakeMapSnapshot(base);
+    bool changed = !SnapshotsShared(snapshot, base);
+    FreeMapSnapshot(base);
+    base = snapshot;
+
+    if ( !changed )
+        return;
+
+    SDL_LockMutex(lock);
+    if ( pending )
+        FreeMapSnapshot(pending); // The writer fell behind; skip to this one.
+    pending = CopyMapSnapshot(snapshot);
+    SDL_CondSignal(wake);
+    SDL_UnlockMutex(lock);
+}
+
+void ResetJournal(const MapSnapshot * saved)
+{
+    if ( base == NULL )
+        return;
+
+    SDL_LockMutex(lock);
+    if ( pending )
+        FreeMapSnapshot(pending);
+    pending = NULL;
+    resetPending = true;
+    SDL_CondSignal(wake);
+    SDL_UnlockMutex(lock);
+
+    // Changes are journaled from the saved map on.
+    FreeMapSnapshot(base);
+    base = CopyMapSnapshot(saved);
+}
+
+void CloseJournal(void)
+{
+    if ( base == NULL )
+        return;
+
+    SDL_LockMutex(lock);
+    quit = true;
+    SDL_CondSignal(wake);
+    SDL_UnlockMutex(lock);
+    SDL_WaitThread(writer, NULL);
+
+    if ( pending )
+        FreeMapSnapshot(pending);
+    pending = NULL;
+
+    FreeMapSnapshot(base);
+    base = NULL;
+
+    if ( file )
+        fclose(file);
+    file = NULL;
+    remove(path);
+
+    SDL_DestroyCond(wake);
+    SDL_DestroyMutex(lock);
+}
@@ -0,0 +1,37 @@
+//
+//  e_journal.h
+//  de
+//
+//  Crash recovery: while editing, the map is journaled to a file next to the
+//  WAD. The journal is emptied when the map is saved and removed when the
+//  editor quits, so finding one with changes in it means the last session
+//  didn't end cleanly.
+//
+
+#ifndef e_journal_h
+#define e_journal_h
+
+#include "m_snapshot.h"
+#include <stdbool.h>
+
+/// How often, at most, the map is checked for changes to journal.
+#define JOURNAL_INTERVAL_MS 1000
+
+/// Start journaling the current map, which was loaded from the WAD at
+/// `wadPath`. If an unclean session left a journal for this map, the changes
+/// in it are restored first.
+/// - returns: Whether changes were restored.
+bool OpenJournal(const char * wadPath);
+
+/// Journal the map if it's been long enough since it was last journaled. The
+/// file is written on another thread. Call once per frame.
+void UpdateJournal(void);
+
+/// Empty the journal after the map has been saved as it was in `saved`.
+/// Changes made since then are journaled next.
+void ResetJournal(const MapSnapshot * saved);
+
+/// Stop journaling and remove the journal file.
+void CloseJournal(void);
+
+#endif /* e_journal_h */
@@ -4,15 +4,21 @@
 //
 //  Created by Thomas Foster on 7/14/23.
 //
+//  Each state is a map snapshot. Consecutive states share the chunks that
+//  didn't change between them.
+//
 
 #include "e_undo.h"
 #include "m_map.h"
+#include "m_grid.h"
+#include "m_adjacency.h"
+#include "m_snapshot.h"
 
 #define MAX_UNDO_STATES 256
 
 typedef struct
 {
-    Map states[MAX_UNDO_STATES];
+    MapSnapshot * states[MAX_UNDO_STATES];
     int current;
     int numStates;
 } History;
@@ -20,52 +26,58 @@ typedef struct
 static History undo;
 static History redo;
 
-/// Overwrite `destination` with a copy of `source`. Map arrays in
-/// `destination` are freed if necessary.
-static void CopyMap(Map * destination, Map * source)
+static MapSnapshot * Newest(const History * hist)
 {
-    ASSERT(destination != NULL);
-    ASSERT(source != NULL);
-
-    if ( destination->vertices != NULL )
-        FreeArray(destination->vertices);
-
-    if ( destination->lines != NULL )
-        FreeArray(destination->lines);
+    if ( hist->numStates == 0 )
+        return NULL;
 
-    if ( destination->things != NULL )
-        FreeArray(destination->things);
-
-    *destination = *source;
+    return hist->states[(hist->current + MAX_UNDO_STATES - 1) % MAX_UNDO_STATES];
+}
 
-    destination->vertices = DeepCopy(source->vertices);
-    destination->lines = DeepCopy(source->lines);
-    destination->things = DeepCopy(source->things);
+static void ClearHistory(History * hist)
+{
+    while ( hist->numStates > 0 )
+    {
+        hist->current = (hist->current + MAX_UNDO_STATES - 1) % MAX_UNDO_STATES;
+        FreeMapSnapshot(hist->states[hist->current]);
+        hist->numStates--;
+    }
+
+    hist->current = 0;
 }
 
-static void PushToHistory(History * hist)
+/// Snapshot the map, sharing what's unchanged with `previous`.
+static void PushToHistory(History * hist, const MapSnapshot * previous)
 {
-    CopyMap(&hist->states[hist->current], &map);
-    hist->current = (hist->current + 1) % MAX_UNDO_STATES;
+    MapSnapshot * snapshot = TakeMapSnapshot(previous);
 
-    if ( hist->numStates < MAX_UNDO_STATES )
+    // When the ring is full, the oldest state is where the next one goes.
+    if ( hist->numStates == MAX_UNDO_STATES )
+        FreeMapSnapshot(hist->states[hist->current]);
+    else
         hist->numStates++;
+
+    hist->states[hist->current] = snapshot;
+    hist->current = (hist->current + 1) % MAX_UNDO_STATES;
 }
 
 static void PopFromHistory(History * hist)
 {
     hist->current = (hist->current + MAX_UNDO_STATES - 1) % MAX_UNDO_STATES;
-    CopyMap(&map, &hist->states[hist->current]);
+    RestoreMapSnapshot(hist->states[hist->current]);
+    FreeMapSnapshot(hist->states[hist->current]);
+    InvalidateMapGrid();
+    InvalidateVertexLines();
+    InvalidateFreeSlots();
     hist->numStates--;
 }
 
 void SaveUndoState(void)
 {
-    PushToHistory(&undo);
+    PushToHistory(&undo, Newest(&undo));
 
     // Clear redo history when making a change.
-    redo.numStates = 0;
-    redo.current = 0;
+    ClearHistory(&redo);
 }
 
 void Undo(void)
@@ -73,7 +85,8 @@ void Undo(void)
     if ( undo.numStates == 0 )
         return;
 
-    PushToHistory(&redo);
+    // The state being left is most like the last one saved.
+    PushToHistory(&redo, Newest(&undo));
     PopFromHistory(&undo);
 }
 
@@ -82,6 +95,6 @@ void Redo(void)
     if ( redo.numStates == 0 )
         return;
 
-    PushToHistory(&undo);
+    PushToHistory(&undo, Newest(&redo));
     PopFromHistory(&redo);
 }
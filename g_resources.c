@@ -0,0 +1,529 @@
+//
+//  g_resources.c
+//  de
+//
+
+#include "g_resources.h"
+#include "common.h"
+#include "doomdata.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+static const char * startMarkers[] = {
+    [NS_SPRITES] = "S_START",
+    [NS_FLATS] = "F_START",
+    [NS_PATCHES] = "P_START",
+};
+
+static const char * endMarkers[] = {
+    [NS_SPRITES] = "S_END",
+    [NS_FLATS] = "F_END",
+    [NS_PATCHES] = "P_END",
+};
+
+// Flats and patches are loaded one numbered block (F1_START...F1_END, etc.) at
+// a time, so new ones go in a block of their own.
+static const char blockPrefixes[] = {
+    [NS_SPRITES] = '\0',
+    [NS_FLATS] = 'F',
+    [NS_PATCHES] = 'P',
+};
+
+#define MAX_BLOCKS 9 // A two-digit block number doesn't fit in a lump name.
+
+typedef struct
+{
+    char name[8];
+    int list; // Which TEXTUREx lump this goes in.
+    maptexture_t * def; // Patch numbers refer to the merged PNAMES.
+    int size;
+} TextureDef;
+
+static s32 ReadLong(const void * data)
+{
+    s32 value;
+    memcpy(&value, data, sizeof(value));
+    return SWAP32(value);
+}
+
+static s16 ReadShort(const void * data)
+{
+    s16 value;
+    memcpy(&value, data, sizeof(value));
+    return SWAP16(value);
+}
+
+static bool IsMarker(const Lump * lump)
+{
+    const char * suffix = strchr(lump->name, '_');
+
+    return lump->size == 0
+        && suffix != NULL
+        && (strcmp(suffix, "_START") == 0 || strcmp(suffix, "_END") == 0);
+}
+
+static bool IsTextureLump(const Lump * lump)
+{
+    return STRNEQ(lump->name, "TEXTURE1", 8)
+        || STRNEQ(lump->name, "TEXTURE2", 8)
+        || STRNEQ(lump->name, "PNAMES", 8);
+}
+
+/// If a map starts at lump `i`, returns how many lumps it has, otherwise 0.
+static int MapSize(const Wad * wad, int i)
+{
+    const char * next = GetNameOfLump(wad, i + 1);
+    if ( next == NULL || !STRNEQ(next, "THINGS", 8) )
+        return 0;
+
+    return MIN(ML_COUNT, wad->lumps->count - i);
+}
+
+/// Copy the lumps of `source` listed in `lumps` to `merged` at its position,
+/// a run of consecutive lumps at a time.
+static void CopyLumpList(Wad * merged, const Wad * source, const Array * lumps)
+{
+    const int * indices = lumps->data;
+
+    for ( int i = 0; i < lumps->count; )
+    {
+        int run = 1;
+        while ( i + run < lumps->count && indices[i + run] == indices[i] + run )
+            run++;
+
+        CopyLumps(merged, source, indices[i], run);
+        i += run;
+    }
+}
+
+/// Add the lumps of `source` listed in `lumps` to the end of `space`.
+static void AddToNamespace(Wad * merged,
+                           LumpNamespace space,
+                           const Wad * source,
+                           const Array * lumps)
+{
+    if ( lumps->count == 0 )
+        return;
+
+    int end = GetIndexOfLumpNamed(merged, endMarkers[space]);
+    if ( end == -1 )
+    {
+        merged->position = merged->lumps->count;
+        AddLump(merged, startMarkers[space], NULL, 0);
+        AddLump(merged, endMarkers[space], NULL, 0);
+        end = merged->lumps->count - 1;
+    }
+
+    merged->position = end;
+
+    char prefix = blockPrefixes[space];
+    char endLabel[10] = { 0 };
+
+    if ( prefix )
+    {
+        char startLabel[10];
+        int block = 0;
+        do
+        {
+            snprintf(startLabel, sizeof(startLabel), "%c%d_START", prefix, ++block);
+        } while ( block < MAX_BLOCKS
+                 && GetIndexOfLumpNamed(merged, startLabel) != -1 );
+
+        snprintf(endLabel, sizeof(endLabel), "%c%d_END", prefix, block);
+
+        if ( GetIndexOfLumpNamed(merged, startLabel) == -1 )
+        {
+            AddLump(merged, startLabel, NULL, 0);
+        }
+        else
+        {
+            // Out of block numbers, so add to the end of the last one.
+            int blockEnd = GetIndexOfLumpNamed(merged, endLabel);
+            if ( blockEnd != -1 )
+                merged->position = blockEnd;
+            endLabel[0] = '\0';
+        }
+    }
+
+    CopyLumpList(merged, source, lumps);
+
+    if ( endLabel[0] )
+        AddLump(merged, endLabel, NULL, 0);
+}
+
+/// Lay `wad` over `merged`: its lumps replace ones with the same name, and the
+/// rest are added.
+static void MergeWad(Wad * merged, const Wad * wad)
+{
+    Array * added[NS_PATCHES + 1];
+    for ( int i = 0; i <= NS_PATCHES; i++ )
+        added[i] = NewArray(64, sizeof(int), 64);
+
+    LumpNamespace space = NS_GLOBAL;
+
+    for ( int i = 0; i < wad->lumps->count; i++ )
+    {
+        const Lump * lump = GetLump(wad, i);
+
+        int mapSize = MapSize(wad, i);
+        if ( mapSize )
+        {
+            i += mapSize - 1;
+            continue;
+        }
+
+        if ( IsMarker(lump) )
+        {
+            space = NamespaceAfter(lump->name, space);
+            continue;
+        }
+
+        if ( space == NS_GLOBAL && IsTextureLump(lump) )
+            continue; // See MergeTextures.
+
+        // Replacing a lump doesn't move any, so the index stays good and this
+        // is a hash lookup each time.
+        int existing = GetIndexOfLumpInNamespace(merged, lump->name, space);
+        if ( existing != -1 )
+            ReplaceLumpFrom(merged, existing, wad, i);
+        else
+            Push(added[space], &i);
+    }
+
+    merged->position = merged->lumps->count;
+    CopyLumpList(merged, wad, added[NS_GLOBAL]);
+
+    AddToNamespace(merged, NS_SPRITES, wad, added[NS_SPRITES]);
+    AddToNamespace(merged, NS_FLATS, wad, added[NS_FLATS]);
+    AddToNamespace(merged, NS_PATCHES, wad, added[NS_PATCHES]);
+
+    for ( int i = 0; i <= NS_PATCHES; i++ )
+        FreeArray(added[i]);
+}
+
+#pragma mark - Textures
+
+/// Open addressing table from 8-character names to array indices.
+typedef struct
+{
+    u64 * keys;
+    int * values; // -1 if the slot is empty.
+    u32 mask;
+} NameTable;
+
+typedef struct
+{
+    Array * names; // char[8], the merged PNAMES.
+    NameTable nameTable;
+    Array * textures; // TextureDef
+    NameTable textureTable;
+} TextureSet;
+
+static NameTable NewNameTable(int capacity)
+{
+    u32 numSlots = 16;
+    while ( numSlots < (u32)capacity * 2 )
+        numSlots *= 2;
+
+    NameTable table;
+    table.keys = malloc(numSlots * sizeof(*table.keys));
+    table.values = malloc(numSlots * sizeof(*table.values));
+    table.mask = numSlots - 1;
+
+    for ( u32 i = 0; i < numSlots; i++ )
+        table.values[i] = -1;
+
+    return table;
+}
+
+static void FreeNameTable(NameTable * table)
+{
+    free(table->keys);
+    free(table->values);
+}
+
+static u64 NameKey(const char * name)
+{
+    char padded[8] = { 0 };
+    for ( int i = 0; i < 8 && name[i]; i++ )
+        padded[i] = SDL_toupper(name[i]);
+
+    u64 key;
+    memcpy(&key, padded, sizeof(key));
+
+    return key;
+}
+
+/// Get the slot for `key`: the one it's in, or the empty one it would go in.
+static u32 FindName(const NameTable * table, u64 key)
+{
+    u32 slot = (u32)((key * 0x9E3779B97F4A7C15) >> 32) & table->mask;
+
+    while ( table->values[slot] != -1 && table->keys[slot] != key )
+        slot = (slot + 1) & table->mask;
+
+    return slot;
+}
+
+/// Get the number of patch `name` in the merged PNAMES, adding it if it's not
+/// there.
+static int PatchNumber(TextureSet * set, const char * name)
+{
+    u64 key = NameKey(name);
+    u32 slot = FindName(&set->nameTable, key);
+
+    if ( set->nameTable.values[slot] == -1 )
+    {
+        char entry[8] = { 0 };
+        strncpy(entry, name, 8);
+        Push(set->names, entry);
+
+        set->nameTable.keys[slot] = key;
+        set->nameTable.values[slot] = set->names->count - 1;
+    }
+
+    return set->nameTable.values[slot];
+}
+
+/// Add the textures in TEXTUREx `lump` to `set`, replacing any with the same
+/// name. `remap` converts the lump's patch numbers to merged ones.
+static void AddTextures(TextureSet * set,
+                        const Lump * lump,
+                        int list,
+                        const int * remap,
+                        int numPatches)
+{
+    const u8 * data = lump->data;
+    if ( lump->size < 4 )
+        return;
+
+    int count = ReadLong(data);
+    if ( count < 0 || count > (lump->size - 4) / 4 )
+    {
+        printf("Error: %s has a bad texture count!\n", lump->name);
+        return;
+    }
+
+    size_t header = offsetof(maptexture_t, patches);
+
+    for ( int i = 0; i < count; i++ )
+    {
+        u32 offset = ReadLong(data + 4 + i * 4);
+        if ( offset + header > (u32)lump->size )
+        {
+            printf("Error: texture %d in %s is out of bounds!\n", i, lump->name);
+            continue;
+        }
+
+        int patchCount = ReadShort(data + offset + offsetof(maptexture_t, patchcount));
+        int size = (int)header + MAX(patchCount, 0) * sizeof(mappatch_t);
+        if ( offset + size > (u32)lump->size )
+        {
+            printf("Error: texture %d in %s is out of bounds!\n", i, lump->name);
+            continue;
+        }
+
+        maptexture_t * def = malloc(size);
+        memcpy(def, data + offset, size);
+
+        for ( int j = 0; j < patchCount; j++ )
+        {
+            int patch = SWAP16(def->patches[j].patch);
+            patch = patch >= 0 && patch < numPatches ? remap[patch] : 0;
+            def->patches[j].patch = SWAP16(patch);
+        }
+
+        u64 key = NameKey(def->name);
+        u32 slot = FindName(&set->textureTable, key);
+
+        if ( set->textureTable.values[slot] != -1 )
+        {
+            TextureDef * texture = Get(set->textures, set->textureTable.values[slot]);
+            free(texture->def);
+            texture->def = def;
+            texture->size = size;
+        }
+        else
+        {
+            TextureDef new = { .list = list, .def = def, .size = size };
+            memcpy(new.name, def->name, 8);
+            Push(set->textures, &new);
+
+            set->textureTable.keys[slot] = key;
+            set->textureTable.values[slot] = set->textures->count - 1;
+        }
+    }
+}
+
+/// Put lump `name` in `merged`, replacing the existing one if there is one.
+/// Takes ownership of `data`.
+static void SetLump(Wad * merged, const char * name, void * data, u32 size)
+{
+    int index = GetIndexOfLumpNamed(merged, name);
+    if ( index != -1 )
+    {
+        ReplaceLump(merged, index, data, size);
+    }
+    else
+    {
+        merged->position = merged->lumps->count;
+        AddLump(merged, name, data, size);
+    }
+
+    free(data);
+}
+
+static void SetTextureLump(Wad * merged, const Array * textures, int list)
+{
+    int count = 0;
+    u32 size = 4;
+
+    TextureDef * texture;
+    FOR_EACH(texture, textures)
+    {
+        if ( texture->list == list )
+        {
+            count++;
+            size += 4 + texture->size;
+        }
+    }
+
+    char name[9];
+    snprintf(name, sizeof(name), "TEXTURE%d", list);
+    if ( count == 0 && GetIndexOfLumpNamed(merged, name) == -1 )
+        return;
+
+    u8 * data = malloc(size);
+    s32 * header = (s32 *)data;
+    header[0] = SWAP32(count);
+
+    u32 offset = 4 + count * 4;
+    int i = 1;
+    FOR_EACH(texture, textures)
+    {
+        if ( texture->list == list )
+        {
+            header[i++] = SWAP32(offset);
+            memcpy(data + offset, texture->def, texture->size);
+            offset += texture->size;
+        }
+    }
+
+    SetLump(merged, name, data, size);
+}
+
+/// Combine the TEXTURE1, TEXTURE2, and PNAMES lumps of all WADs into
+/// `merged`'s. IWAD textures keep their place and patch numbers. A texture in
+/// a higher WAD replaces the one with the same name, and new ones are added to
+/// TEXTURE1.
+static void MergeTextures(Wad * merged, Wad * const * wads, int count)
+{
+    bool needed = false;
+    for ( int w = 1; w < count; w++ )
+    {
+        if (   GetIndexOfLumpNamed(wads[w], "TEXTURE1") != -1
+            || GetIndexOfLumpNamed(wads[w], "TEXTURE2") != -1
+            || GetIndexOfLumpNamed(wads[w], "PNAMES") != -1 )
+            needed = true;
+    }
+
+    if ( !needed )
+        return;
+
+    // Every name in every PNAMES and TEXTUREx lump fits in these tables.
+    int capacity = 0;
+    for ( int w = 0; w < count; w++ )
+    {
+        const char * lumpNames[] = { "PNAMES", "TEXTURE1", "TEXTURE2" };
+        for ( int i = 0; i < 3; i++ )
+        {
+            const Lump * lump = GetLumpNamed(wads[w], lumpNames[i]);
+            if ( lump )
+                capacity += lump->size / 8;
+        }
+    }
+
+    TextureSet set = {
+        .names = NewArray(512, 8, 512),
+        .nameTable = NewNameTable(capacity),
+        .textures = NewArray(512, sizeof(TextureDef), 512),
+        .textureTable = NewNameTable(capacity),
+    };
+
+    const Lump * pnames = NULL;
+    int numPatches = 0;
+
+    for ( int w = 0; w < count; w++ )
+    {
+        // A WAD's textures use its own PNAMES, or the nearest one below it.
+        const Lump * lump = GetLumpNamed(wads[w], "PNAMES");
+        if ( lump != NULL && lump->size >= 4 )
+        {
+            pnames = lump;
+            numPatches = ReadLong(pnames->data);
+            if ( numPatches < 0 || numPatches > (pnames->size - 4) / 8 )
+            {
+                printf("Error: %s has a bad patch count!\n", pnames->name);
+                numPatches = 0;
+            }
+        }
+
+        int * remap = NULL;
+
+        if ( pnames )
+        {
+            remap = malloc((numPatches + 1) * sizeof(*remap));
+
+            const char * name = (const char *)pnames->data + 4;
+            for ( int i = 0; i < numPatches; i++, name += 8 )
+                remap[i] = PatchNumber(&set, name);
+        }
+
+        for ( int list = 1; list <= 2; list++ )
+        {
+            char lumpName[9];
+            snprintf(lumpName, sizeof(lumpName), "TEXTURE%d", list);
+
+            lump = GetLumpNamed(wads[w], lumpName);
+            if ( lump != NULL )
+                AddTextures(&set, lump, w == 0 ? list : 1, remap, numPatches);
+        }
+
+        free(remap);
+    }
+
+    u32 size = 4 + set.names->count * 8;
+    u8 * data = malloc(size);
+    *(s32 *)data = SWAP32(set.names->count);
+    memcpy(data + 4, set.names->data, set.names->count * 8);
+    SetLump(merged, "PNAMES", data, size);
+
+    SetTextureLump(merged, set.textures, 1);
+    SetTextureLump(merged, set.textures, 2);
+
+    TextureDef * texture;
+    FOR_EACH(texture, set.textures)
+        free(texture->def);
+
+    FreeArray(set.textures);
+    FreeArray(set.names);
+    FreeNameTable(&set.textureTable);
+    FreeNameTable(&set.nameTable);
+}
+
+#pragma mark -
+
+Wad * MergeResourceWads(Wad * const * wads, int count)
+{
+    Wad * merged = NewWad(wads[0]->path);
+    merged->type = IWAD;
+    CopyLumps(merged, wads[0], 0, wads[0]->lumps->count);
+
+    for ( int i = 1; i < count; i++ )
+        MergeWad(merged, wads[i]);
+
+    MergeTextures(merged, wads, count);
+
+    return merged;
+}
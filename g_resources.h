@@ -0,0 +1,24 @@
+//
+//  g_resources.h
+//  de
+//
+//  The resource stack: an IWAD plus any PWADs that add to or replace its
+//  graphics, merged into one WAD so lookups only ever search one index.
+//
+
+#ifndef g_resources_h
+#define g_resources_h
+
+#include "wad.h"
+
+/// Merge `count` WADs, bottom first, into a new WAD in memory.
+///
+/// A lump replaces one with the same name below it. Sprites, flats, and
+/// patches are matched within their marker ranges, and new ones are added to
+/// the end of the range, flats and patches in a new F#/P# block. TEXTURE1,
+/// TEXTURE2, and PNAMES are merged by texture and patch name. Maps are left
+/// out. Data that's in a file mapping is shared with the source WADs, which can
+/// be freed afterward.
+Wad * MergeResourceWads(Wad * const * wads, int count);
+
+#endif /* g_resources_h */
@@ -167,7 +167,9 @@ void LoadThingDefinitions(void)
         if ( len > maxLen )
             maxLen = len;
 
-        int lumpIndex = GetIndexOfLumpNamed(editor.iwad, sprite);
+        int lumpIndex = GetIndexOfLumpInNamespace(editor.iwad,
+                                                  sprite,
+                                                  NS_SPRITES);
         def->patch = LoadPatch(editor.iwad, lumpIndex);
 
         // Set palette rect
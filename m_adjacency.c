@@ -0,0 +1,143 @@
+//
+//  m_adjacency.c
+//  de
+//
+
+#include "m_adjacency.h"
+#include "m_map.h"
+
+#define NO_LINK (-1)
+
+/// Where each end of a line is linked. A link is `line * 2 + end`.
+typedef struct
+{
+    int vertex[2]; // NO_LINK if the line isn't linked.
+    int next[2];
+} LineLinks;
+
+static Array * heads; // First link at each vertex.
+static Array * links; // LineLinks for each line.
+static bool valid;
+
+static int LineVertex(const Line * line, int end)
+{
+    return end == 0 ? line->v1 : line->v2;
+}
+
+static int * NextLink(int link)
+{
+    LineLinks * l = Get(links, link / 2);
+    return &l->next[link % 2];
+}
+
+static void Link(int index)
+{
+    const Line * line = Get(map.lines, index);
+    LineLinks * l = Get(links, index);
+
+    for ( int end = 0; end < 2; end++ )
+    {
+        int vertex = LineVertex(line, end);
+
+        int none = NO_LINK;
+        while ( heads->count <= vertex )
+            Push(heads, &none);
+
+        int * head = Get(heads, vertex);
+        l->vertex[end] = vertex;
+        l->next[end] = *head;
+        *head = index * 2 + end;
+    }
+}
+
+static void Unlink(int index)
+{
+    LineLinks * l = Get(links, index);
+
+    for ( int end = 0; end < 2; end++ )
+    {
+        if ( l->vertex[end] == NO_LINK )
+            continue;
+
+        int * link = Get(heads, l->vertex[end]);
+        while ( *link != index * 2 + end )
+            link = NextLink(*link);
+
+        *link = l->next[end];
+        l->vertex[end] = l->next[end] = NO_LINK;
+    }
+}
+
+static void Rebuild(void)
+{
+    if ( heads == NULL )
+    {
+        heads = NewArray(map.vertices->count, sizeof(int), ARRAY_DOUBLE);
+        links = NewArray(map.lines->count, sizeof(LineLinks), ARRAY_DOUBLE);
+    }
+
+    Clear(heads);
+    Clear(links);
+
+    int none = NO_LINK;
+    for ( int i = 0; i < map.vertices->count; i++ )
+        Push(heads, &none);
+
+    LineLinks unlinked = { { NO_LINK, NO_LINK }, { NO_LINK, NO_LINK } };
+    for ( int i = 0; i < map.lines->count; i++ )
+        Push(links, &unlinked);
+
+    // Link backwards so each list starts out in ascending order.
+    for ( int i = map.lines->count - 1; i >= 0; i-- )
+        if ( !((Line *)Get(map.lines, i))->deleted )
+            Link(i);
+
+    valid = true;
+}
+
+void InvalidateVertexLines(void)
+{
+    valid = false;
+}
+
+void UpdateVertexLines(int index)
+{
+    if ( !valid )
+        return; // It'll all be linked when it's rebuilt.
+
+    LineLinks unlinked = { { NO_LINK, NO_LINK }, { NO_LINK, NO_LINK } };
+    while ( links->count <= index )
+        Push(links, &unlinked);
+
+    Unlink(index);
+    if ( !((Line *)Get(map.lines, index))->deleted )
+        Link(index);
+}
+
+void GetVertexLines(int vertex, Array * out)
+{
+    if ( !valid )
+        Rebuild();
+
+    Clear(out);
+
+    if ( vertex >= heads->count )
+        return;
+
+    for ( int link = *(int *)Get(heads, vertex);
+          link != NO_LINK;
+          link = *NextLink(link) )
+    {
+        int index = link / 2;
+
+        // Insertion sort: lists are short, and mostly in order already. A line
+        // with both ends here is only listed once.
+        int i = out->count;
+        int * indices = out->data;
+        while ( i > 0 && indices[i - 1] > index )
+            i--;
+
+        if ( i == 0 || indices[i - 1] != index )
+            Insert(out, &index, i);
+    }
+}
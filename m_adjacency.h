@@ -0,0 +1,25 @@
+//
+//  m_adjacency.h
+//  de
+//
+//  Which lines use each vertex: a linked list per vertex threaded through a
+//  pair of links per line, so adding or removing a line costs O(degree).
+//
+
+#ifndef m_adjacency_h
+#define m_adjacency_h
+
+#include "array.h"
+
+/// Mark the whole index out of date, after the map's arrays are replaced. It's
+/// rebuilt by the next query.
+void InvalidateVertexLines(void);
+
+/// Re-link line `index` after it's added or deleted, or its vertices change.
+void UpdateVertexLines(int index);
+
+/// Fill `out` with the indices, in ascending order, of the live lines that
+/// use `vertex`.
+void GetVertexLines(int vertex, Array * out);
+
+#endif /* m_adjacency_h */
@@ -0,0 +1,347 @@
+//
+//  m_grid.c
+//  de
+//
+
+#include "m_grid.h"
+#include "m_map.h"
+#include "common.h"
+
+#include <limits.h>
+#include <math.h>
+
+/// Where an object was indexed, so it can be removed after it moves.
+typedef struct
+{
+    SDL_Point p1;
+    SDL_Point p2; // Lines only.
+    bool indexed;
+} GridShape;
+
+typedef struct
+{
+    int x; // Cell coordinates.
+    int y;
+    Array * items; // Object indices. NULL if this slot is unused.
+} GridCell;
+
+typedef struct
+{
+    GridCell * cells; // Open addressed hash table.
+    int numCells;
+    int capacity; // A power of two.
+
+    Array * shapes; // GridShape for each object.
+    Array * stamps; // Query stamp for each object, to skip duplicates.
+    int stamp;
+
+    // Range of cells that have been used.
+    int minX, minY;
+    int maxX, maxY;
+} Grid;
+
+static Grid grids[NUM_MAP_GRIDS];
+static bool valid;
+
+static int CellCoord(int a)
+{
+    return a >= 0 ? a / GRID_CELL_SIZE : -((-a + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE);
+}
+
+static u32 CellHash(int x, int y)
+{
+    return ((u32)x * 73856093u) ^ ((u32)y * 19349663u);
+}
+
+static Array * ObjectArray(GridKind kind)
+{
+    switch ( kind )
+    {
+        case MAP_VERTICES: return map.vertices;
+        case MAP_LINES:    return map.lines;
+        default:            return map.things;
+    }
+}
+
+static bool IsLive(GridKind kind, int index)
+{
+    switch ( kind )
+    {
+        case MAP_VERTICES: return !((Vertex *)Get(map.vertices, index))->removed;
+        case MAP_LINES:    return !((Line *)Get(map.lines, index))->deleted;
+        default:            return !((Thing *)Get(map.things, index))->deleted;
+    }
+}
+
+static GridShape CurrentShape(GridKind kind, int index)
+{
+    GridShape shape = { .indexed = true };
+
+    switch ( kind )
+    {
+        case MAP_VERTICES:
+            shape.p1 = shape.p2 = ((Vertex *)Get(map.vertices, index))->origin;
+            break;
+        case MAP_LINES:
+            GetLinePoints(index, &shape.p1, &shape.p2);
+            break;
+        default:
+            shape.p1 = shape.p2 = ((Thing *)Get(map.things, index))->origin;
+            break;
+    }
+
+    return shape;
+}
+
+#pragma mark - Cells
+
+static void FreeGrid(Grid * grid)
+{
+    for ( int i = 0; i < grid->capacity; i++ )
+        if ( grid->cells[i].items )
+            FreeArray(grid->cells[i].items);
+
+    free(grid->cells);
+    if ( grid->shapes )
+        FreeArray(grid->shapes);
+    if ( grid->stamps )
+        FreeArray(grid->stamps);
+
+    *grid = (Grid){ 0 };
+}
+
+static GridCell * FindCell(const Grid * grid, int x, int y)
+{
+    u32 mask = grid->capacity - 1;
+    u32 i = CellHash(x, y) & mask;
+
+    while ( grid->cells[i].items && (grid->cells[i].x != x || grid->cells[i].y != y) )
+        i = (i + 1) & mask;
+
+    return &grid->cells[i];
+}
+
+static void ResizeCells(Grid * grid, int capacity)
+{
+    GridCell * old = grid->cells;
+    int oldCapacity = grid->capacity;
+
+    grid->cells = calloc(capacity, sizeof(*grid->cells));
+    grid->capacity = capacity;
+
+    for ( int i = 0; i < oldCapacity; i++ )
+        if ( old[i].items )
+            *FindCell(grid, old[i].x, old[i].y) = old[i];
+
+    free(old);
+}
+
+static void AddToCell(Grid * grid, int x, int y, int index)
+{
+    if ( (grid->numCells + 1) * 2 > grid->capacity )
+        ResizeCells(grid, MAX(grid->capacity * 2, 256));
+
+    GridCell * cell = FindCell(grid, x, y);
+    if ( cell->items == NULL )
+    {
+        *cell = (GridCell){ .x = x, .y = y };
+        cell->items = NewArray(4, sizeof(int), 4);
+        grid->numCells++;
+
+        grid->minX = MIN(grid->minX, x);
+        grid->minY = MIN(grid->minY, y);
+        grid->maxX = MAX(grid->maxX, x);
+        grid->maxY = MAX(grid->maxY, y);
+    }
+
+    Push(cell->items, &index);
+}
+
+static void RemoveFromCell(Grid * grid, int x, int y, int index)
+{
+    if ( grid->capacity == 0 )
+        return;
+
+    GridCell * cell = FindCell(grid, x, y);
+    if ( cell->items == NULL )
+        return;
+
+    int * items = cell->items->data;
+    for ( int i = 0; i < cell->items->count; i++ )
+    {
+        if ( items[i] == index )
+        {
+            FastRemove(cell->items, i);
+            return;
+        }
+    }
+}
+
+/// Add or remove `index` in every cell the shape touches. For lines, that's
+/// each cell the segment passes through, with a unit of slack.
+static void MarkShape(Grid * grid, const GridShape * shape, int index, bool add)
+{
+    SDL_Point p1 = shape->p1;
+    SDL_Point p2 = shape->p2;
+    int minX = MIN(p1.x, p2.x);
+    int maxX = MAX(p1.x, p2.x);
+    int minY = MIN(p1.y, p2.y);
+    int maxY = MAX(p1.y, p2.y);
+
+    for ( int cx = CellCoord(minX); cx <= CellCoord(maxX); cx++ )
+    {
+        int top = minY;
+        int bottom = maxY;
+
+        if ( p1.x != p2.x )
+        {
+            // Where the segment enters and leaves this column.
+            double x1 = MAX(minX, cx * GRID_CELL_SIZE);
+            double x2 = MIN(maxX, (cx + 1) * GRID_CELL_SIZE);
+            double slope = (double)(p2.y - p1.y) / (p2.x - p1.x);
+            double y1 = p1.y + (x1 - p1.x) * slope;
+            double y2 = p1.y + (x2 - p1.x) * slope;
+
+            top = MAX(minY, (int)floor(MIN(y1, y2)) - 1);
+            bottom = MIN(maxY, (int)ceil(MAX(y1, y2)) + 1);
+        }
+
+        for ( int cy = CellCoord(top); cy <= CellCoord(bottom); cy++ )
+        {
+            if ( add )
+                AddToCell(grid, cx, cy, index);
+            else
+                RemoveFromCell(grid, cx, cy, index);
+        }
+    }
+}
+
+#pragma mark -
+
+static void Rebuild(void)
+{
+    for ( GridKind kind = 0; kind < NUM_MAP_GRIDS; kind++ )
+    {
+        Grid * grid = &grids[kind];
+        FreeGrid(grid);
+
+        Array * objects = ObjectArray(kind);
+        grid->shapes = NewArray(objects->count, sizeof(GridShape), 16);
+        grid->stamps = NewArray(objects->count, sizeof(int), 16);
+        grid->minX = grid->minY = INT_MAX;
+        grid->maxX = grid->maxY = INT_MIN;
+
+        for ( int i = 0; i < objects->count; i++ )
+        {
+            GridShape shape = { 0 };
+            if ( IsLive(kind, i) )
+            {
+                shape = CurrentShape(kind, i);
+                MarkShape(grid, &shape, i, true);
+            }
+
+            int stamp = 0;
+            Push(grid->shapes, &shape);
+            Push(grid->stamps, &stamp);
+        }
+    }
+
+    valid = true;
+}
+
+void InvalidateMapGrid(void)
+{
+    valid = false;
+}
+
+void UpdateMapGrid(GridKind kind, int index)
+{
+    if ( !valid )
+        return; // It'll all be indexed when it's rebuilt.
+
+    Grid * grid = &grids[kind];
+
+    // Make room for new objects.
+    GridShape none = { 0 };
+    int stamp = 0;
+    while ( grid->shapes->count <= index )
+    {
+        Push(grid->shapes, &none);
+        Push(grid->stamps, &stamp);
+    }
+
+    GridShape * shape = Get(grid->shapes, index);
+    if ( shape->indexed )
+        MarkShape(grid, shape, index, false);
+
+    *shape = none;
+    if ( IsLive(kind, index) )
+    {
+        *shape = CurrentShape(kind, index);
+        MarkShape(grid, shape, index, true);
+    }
+}
+
+static int CompareIndices(const void * a, const void * b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+void QueryMapGrid(GridKind kind, const SDL_Rect * rect, Array * out)
+{
+    if ( !valid )
+        Rebuild();
+
+    Clear(out);
+
+    Grid * grid = &grids[kind];
+    if ( grid->numCells == 0 )
+        return;
+
+    int left = MAX(CellCoord(rect->x), grid->minX);
+    int top = MAX(CellCoord(rect->y), grid->minY);
+    int right = MIN(CellCoord(rect->x + rect->w), grid->maxX);
+    int bottom = MIN(CellCoord(rect->y + rect->h), grid->maxY);
+
+    grid->stamp++;
+    int * stamps = grid->stamps->data;
+
+    for ( int y = top; y <= bottom; y++ )
+    {
+        for ( int x = left; x <= right; x++ )
+        {
+            GridCell * cell = FindCell(grid, x, y);
+            if ( cell->items == NULL )
+                continue;
+
+            int * item;
+            FOR_EACH(item, cell->items)
+            {
+                if ( stamps[*item] != grid->stamp && IsLive(kind, *item) )
+                {
+                    stamps[*item] = grid->stamp;
+                    Push(out, item);
+                }
+            }
+        }
+    }
+
+    qsort(out->data, out->count, sizeof(int), CompareIndices);
+}
+
+SDL_Rect MapGridBounds(GridKind kind)
+{
+    if ( !valid )
+        Rebuild();
+
+    const Grid * grid = &grids[kind];
+    if ( grid->numCells == 0 )
+        return (SDL_Rect){ 0 };
+
+    return (SDL_Rect){
+        .x = grid->minX * GRID_CELL_SIZE,
+        .y = grid->minY * GRID_CELL_SIZE,
+        .w = (grid->maxX - grid->minX + 1) * GRID_CELL_SIZE,
+        .h = (grid->maxY - grid->minY + 1) * GRID_CELL_SIZE
+    };
+}
@@ -0,0 +1,43 @@
+//
+//  m_grid.h
+//  de
+//
+//  Spatial index of the map's vertices, lines, and things: a uniform grid
+//  whose cells are hashed, so only cells with something in them use memory.
+//
+
+#ifndef m_grid_h
+#define m_grid_h
+
+#include "array.h"
+
+#include <SDL2/SDL.h>
+
+#define GRID_CELL_SIZE 128
+
+typedef enum
+{
+    MAP_VERTICES,
+    MAP_LINES,
+    MAP_THINGS,
+    NUM_MAP_GRIDS
+} GridKind;
+
+/// Mark the whole index out of date, after the map's arrays are replaced. It's
+/// rebuilt by the next query.
+void InvalidateMapGrid(void);
+
+/// Re-index vertex, line, or thing `index` after it's added, moved, or
+/// deleted. Lines must be updated when their vertices move.
+void UpdateMapGrid(GridKind kind, int index);
+
+/// Fill `out` with the indices, in ascending order, of the live objects in the
+/// cells that overlap `rect` (edges included). Objects outside `rect` may be
+/// included, so the caller must still test each one.
+void QueryMapGrid(GridKind kind, const SDL_Rect * rect, Array * out);
+
+/// The area covered by every cell that has held an object of `kind`. Nothing
+/// can be found outside it.
+SDL_Rect MapGridBounds(GridKind kind);
+
+#endif /* m_grid_h */
@@ -90,6 +90,19 @@ void GetLinePoints(int index, SDL_Point * p1, SDL_Point * p2)
     *p2 = vertices[line->v2].origin;
 }
 
+/// - parameter line: A line in `map.lines`.
+int LineIndex(const Line * line)
+{
+    return (int)(line - (const Line *)map.lines->data);
+}
+
+/// Get line `index`'s front and back sides.
+Sidedef * GetLineSides(int index)
+{
+    return ((LineSides *)Get(map.lineSides, index))->sides;
+}
+
+/// - parameter line: A line in `map.lines`.
 Sidedef * SelectedSide(Line * line)
 {
     if ( line->selected == DESELECTED )
@@ -98,7 +111,7 @@ Sidedef * SelectedSide(Line * line)
     if ( line->deleted )
         return NULL;
 
-    return &line->sides[line->selected - 1];
+    return &GetLineSides(LineIndex(line))[line->selected - 1];
 }
 
 void ClipLine(int lineIndex, SDL_Point * out1, SDL_Point * out2)
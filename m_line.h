@@ -69,10 +69,11 @@ typedef struct
     int sectorNum; // Used by the node builder.
 } Sidedef;
 
+/// The parts of a line that drawing, selection, and editing geometry look at.
+/// Kept small, since `map.lines` is scanned every frame; the sides are in
+/// `map.lineSides`, at the same index.
 typedef struct
 {
-    NXPoint p1, p2; // Only used by node builder.
-
     int v1; // The index in map.vertices
     int v2; // The index in map.vertices
 
@@ -80,8 +81,6 @@ typedef struct
     int special;
     int tag;
 
-    Sidedef sides[2];
-
     enum
     {
         DESELECTED,
@@ -95,11 +94,18 @@ typedef struct
     bool panelBackSelected;
 } Line;
 
+typedef struct
+{
+    Sidedef sides[NUM_SIDES];
+} LineSides;
+
 void        InitLineCross(void);
 SDL_FPoint  LineMidpoint(const Line * line);
 float       LineLength(const Line * line);
 SDL_FPoint  LineNormal(const Line * line, float length);
 void        GetLinePoints(int index, SDL_Point * p1, SDL_Point * p2);
+int         LineIndex(const Line * line);
+Sidedef *   GetLineSides(int index);
 Sidedef *   SelectedSide(Line * line);
 void        ClipLine(int lineIndex, SDL_Point * out1, SDL_Point * out2);
 Visibility  LineVisibility(int index);
@@ -6,6 +6,8 @@
 //
 
 #include "m_map.h"
+#include "m_grid.h"
+#include "m_adjacency.h"
 #include "wad.h"
 #include "doomdata.h"
 #include "common.h"
@@ -22,21 +24,21 @@ Map map;
 bool VertexOnLine(const Vertex * vertex, const Line * line)
 {
     Vertex * vertices = map.vertices->data;
-    float x1 = vertices[line->v1].origin.x;
-    float x2 = vertices[line->v2].origin.x;
-    float y1 = vertices[line->v1].origin.y;
-    float y2 = vertices[line->v2].origin.y;
-    float x = vertex->origin.x;
-    float y = vertex->origin.y;
-
-    if ( (x == x1 && y == y1) || (x == x2 && y == y2) )
+    SDL_Point a = vertices[line->v1].origin;
+    SDL_Point b = vertices[line->v2].origin;
+    SDL_Point p = vertex->origin;
+
+    if ( PointsEqual(&p, &a) || PointsEqual(&p, &b) )
         return false;
 
-    float ab = sqrtf((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
-    float ap = sqrtf((x - x1) * (x - x1) + (y - y1) * (y - y1));
-    float pb = sqrtf((x2 - x) * (x2 - x) + (y2 - y) * (y2 - y));
+    // Exactly collinear...
+    s64 cross = (s64)(b.x - a.x) * (p.y - a.y) - (s64)(b.y - a.y) * (p.x - a.x);
+    if ( cross != 0 )
+        return false;
 
-    return fabsf(ap + pb - ab) < 0.00001f;
+    // ...and between the endpoints.
+    return p.x >= MIN(a.x, b.x) && p.x <= MAX(a.x, b.x)
+        && p.y >= MIN(a.y, b.y) && p.y <= MAX(a.y, b.y);
 }
 
 bool GetClosestSide(const SDL_Point * point, Sidedef * out)
@@ -48,44 +50,80 @@ bool GetClosestSide(const SDL_Point * point, Sidedef * out)
     float y = (float)point->y + 0.5f;
 
 
-    // find the closest line to the given point
+    // find the closest line to the given point: search the point's row of
+    // grid cells, working outward from its cell, until no line in the next
+    // columns could be closer.
+
+    static Array * candidates;
+    if ( candidates == NULL )
+        candidates = NewArray(64, sizeof(int), 64);
+
+    SDL_Rect bounds = MapGridBounds(MAP_LINES);
+    int column = (int)floorf(x / GRID_CELL_SIZE);
+    int row = (int)floorf(y / GRID_CELL_SIZE);
 
-    Line * lines = map.lines->data;
     float bestdistance = MAXFLOAT;
-    for ( int l = 0; l < map.lines->count; l++ )
+    for ( int ring = 0; bounds.w > 0; ring++ )
     {
-        if ( lines[l].deleted )
-            continue;
+        int left = column - ring;
+        int right = column + ring;
 
-        SDL_Point p1, p2;
-        GetLinePoints(l, &p1, &p2);
+        if (   (left + 1) * GRID_CELL_SIZE <= bounds.x
+            && right * GRID_CELL_SIZE >= bounds.x + bounds.w )
+            break; // Past the edges of the map.
 
-        if ( p1.y == p2.y )
-            continue;
-
-        if ( p1.y < p2.y )
+        int columns[2] = { left, right };
+        for ( int c = 0; c < (ring == 0 ? 1 : 2); c++ )
         {
-            frac = (y - p1.y) / (p2.y - p1.y);
-            if ( frac < 0.0f || frac > 1.0f )
-                continue;
+            SDL_Rect cell = {
+                .x = columns[c] * GRID_CELL_SIZE,
+                .y = row * GRID_CELL_SIZE,
+                .w = GRID_CELL_SIZE - 1,
+                .h = 0
+            };
+            QueryMapGrid(MAP_LINES, &cell, candidates);
+
+            int * l;
+            FOR_EACH(l, candidates)
+            {
+                SDL_Point p1, p2;
+                GetLinePoints(*l, &p1, &p2);
 
-            xintercept = p1.x + frac * (p2.x - p1.x);
-        }
-        else
-        {
-            frac = (y - p2.y) / (p1.y - p2.y);
-            if ( frac < 0.0f || frac > 1.0f )
-                continue;
+                if ( p1.y == p2.y )
+                    continue;
 
-            xintercept = p2.x + frac * (p1.x - p2.x);
-        }
+                if ( p1.y < p2.y )
+                {
+                    frac = (y - p1.y) / (p2.y - p1.y);
+                    if ( frac < 0.0f || frac > 1.0f )
+                        continue;
 
-        distance = fabsf(xintercept - x);
-        if ( distance < bestdistance )
-        {
-            bestdistance = distance;
-            bestline = l;
+                    xintercept = p1.x + frac * (p2.x - p1.x);
+                }
+                else
+                {
+                    frac = (y - p2.y) / (p1.y - p2.y);
+                    if ( frac < 0.0f || frac > 1.0f )
+                        continue;
+
+                    xintercept = p2.x + frac * (p1.x - p2.x);
+                }
+
+                // Ties go to the lowest numbered line.
+                distance = fabsf(xintercept - x);
+                if (   distance < bestdistance
+                    || (distance == bestdistance && *l < bestline) )
+                {
+                    bestdistance = distance;
+                    bestline = *l;
+                }
+            }
         }
+
+        float nextColumnDistance = MIN((right + 1) * GRID_CELL_SIZE - x,
+                                       x - left * GRID_CELL_SIZE);
+        if ( bestdistance < nextColumnDistance )
+            break;
     }
 
     // If no line is intercepted, the point was outside all areas.
@@ -93,6 +131,7 @@ bool GetClosestSide(const SDL_Point * point, Sidedef * out)
         return false;
 
     Line * line = Get(map.lines, bestline);
+    Sidedef * sides = GetLineSides(bestline);
 
     SDL_Point p1, p2;
     GetLinePoints(bestline, &p1, &p2);
@@ -104,7 +143,7 @@ bool GetClosestSide(const SDL_Point * point, Sidedef * out)
         if ( side == 1 && !(line->flags & ML_TWOSIDED) )
             return false;
 
-        *out = line->sides[side];
+        *out = sides[side];
         return true;
     }
 
@@ -115,7 +154,7 @@ bool GetClosestSide(const SDL_Point * point, Sidedef * out)
         if ( side == 1 && !(line->flags & ML_TWOSIDED) )
             return false;
 
-        *out = line->sides[side];
+        *out = sides[side];
         return true;
     }
 
@@ -129,9 +168,9 @@ bool GetClosestSide(const SDL_Point * point, Sidedef * out)
     bool test = y > slope * x + yintercept;
 
     if (direction == test)
-        *out = line->sides[0];
+        *out = sides[0];
     else
-        *out = line->sides[1];
+        *out = sides[1];
 
     return true;
 }
@@ -209,7 +248,11 @@ void CreateMap(const char * label)
 
     map.vertices = NewArray(0, sizeof(Vertex), 16);
     map.lines = NewArray(0, sizeof(Line), 16);
+    map.lineSides = NewArray(0, sizeof(LineSides), 16);
     map.things = NewArray(0, sizeof(Thing), 16);
+    InvalidateMapGrid();
+    InvalidateVertexLines();
+    InvalidateFreeSlots();
 
     map.boundsDirty = true;
     GetMapBounds();
@@ -235,6 +278,7 @@ bool LoadMap(const Wad * wad, const char * lumpLabel)
 
     map.vertices = NewArray(numVertices, sizeof(Vertex), 16);
     map.lines = NewArray(numLines, sizeof(Line), 16);
+    map.lineSides = NewArray(numLines, sizeof(LineSides), 16);
     map.things = NewArray(numThings, sizeof(Thing), 16);
 
 
@@ -276,6 +320,7 @@ bool LoadMap(const Wad * wad, const char * lumpLabel)
     for ( int i = 0; i < numLines; i++ )
     {
         Line line = { 0 };
+        LineSides sides = { 0 };
 
         line.v1 = lineData[i].v1;
         vertices[line.v1].referenceCount++;
@@ -296,8 +341,7 @@ bool LoadMap(const Wad * wad, const char * lumpLabel)
             if ( lineData[i].sidenum[s] == -1 )
                 continue;
 
-            Sidedef * side = &line.sides[s];
-            memset(side, 0, sizeof(*side));
+            Sidedef * side = &sides.sides[s];
 
             mapsidedef_t * mside = &sidedefData[lineData[i].sidenum[s]];
             side->offsetX = mside->textureoffset;
@@ -322,15 +366,55 @@ bool LoadMap(const Wad * wad, const char * lumpLabel)
         }
 
         Push(map.lines, &line);
+        Push(map.lineSides, &sides);
 //        printf("loaded line %3d: %3d, %3d\n", i, line.v1, line.v2);
     }
 
+    InvalidateMapGrid();
+    InvalidateVertexLines();
+    InvalidateFreeSlots();
+
     map.boundsDirty = true;
     GetMapBounds();
 
     return true;
 }
 
+static int CompareVertexPositions(const void * a, const void * b)
+{
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+    const SDL_Point * pa = &((Vertex *)map.vertices->data)[ia].origin;
+    const SDL_Point * pb = &((Vertex *)map.vertices->data)[ib].origin;
+
+    if ( pa->x != pb->x )
+        return pa->x < pb->x ? -1 : 1;
+    if ( pa->y != pb->y )
+        return pa->y < pb->y ? -1 : 1;
+
+    return (ia > ib) - (ia < ib);
+}
+
+/// Get the indices of all vertices that haven't been removed, sorted by
+/// position and then by index, so overlapping vertices end up next to each
+/// other with the lowest index first.
+static int * SortVerticesByPosition(int * count)
+{
+    Vertex * vertices = map.vertices->data;
+    int * sorted = malloc(map.vertices->count * sizeof(*sorted) + 1);
+
+    *count = 0;
+    for ( int i = 0; i < map.vertices->count; i++ )
+    {
+        if ( !vertices[i].removed )
+            sorted[(*count)++] = i;
+    }
+
+    qsort(sorted, *count, sizeof(*sorted), CompareVertexPositions);
+
+    return sorted;
+}
+
 int CheckMap(void)
 {
     printf("\nRunning map check...\n");
@@ -340,49 +424,47 @@ int CheckMap(void)
     // Check for overlapping vertices.
     //
 
-    bool * overlappingVertices = calloc(map.vertices->count, sizeof(bool));
+    int count;
+    int * sorted = SortVerticesByPosition(&count);
+    Vertex * vertices = map.vertices->data;
 
-    for ( int i = 0; i < map.vertices->count; i++ )
+    for ( int i = 1; i < count; i++ )
     {
-        SDL_Point vi = ((Vertex *)Get(map.vertices, i))->origin;
+        SDL_Point * prev = &vertices[sorted[i - 1]].origin;
+        SDL_Point * v = &vertices[sorted[i]].origin;
 
-        for ( int j = i + 1; j < map.vertices->count; j++ )
+        if ( PointsEqual(prev, v) )
         {
-            SDL_Point vj = ((Vertex *)Get(map.vertices, j))->origin;
-
-            if ( vi.x == vj.x && vi.y == vj.y )
-            {
-                numProblems++;
-                overlappingVertices[i] = true; // Mark both as overlapping.
-                overlappingVertices[j] = true;
-                printf("Overlapping Vertex at %d, %d!\n", vi.x, vi.y);
-            }
+            numProblems++;
+            printf("Overlapping Vertex at %d, %d!\n", v->x, v->y);
         }
     }
 
-    free(overlappingVertices);
+    free(sorted);
+
+    int numThings = 0;
+    bool hasPlayerOneStart = false;
+
+    for ( int i = 0; i < map.things->count; i++ )
+    {
+        Thing * thing = Get(map.things, i);
+        if ( thing->deleted )
+            continue;
+
+        numThings++;
+        if ( thing->type == 1 )
+            hasPlayerOneStart = true;
+    }
 
-    if ( map.things->count == 0 )
+    if ( numThings == 0 )
     {
         numProblems++;
         printf("Map has no things!\n");
     }
-    else
+    else if ( !hasPlayerOneStart )
     {
-        bool hasPlayerOneStart = false;
-
-        for ( int i = 0; i < map.things->count; i++ )
-        {
-            Thing * thing = Get(map.things, i);
-            if ( thing->type == 1 )
-                hasPlayerOneStart = true;
-        }
-
-        if ( !hasPlayerOneStart )
-        {
-            printf("Map has no Player 1 start!\n");
-            numProblems++;
-        }
+        printf("Map has no Player 1 start!\n");
+        numProblems++;
     }
 
     if ( numProblems == 0 )
@@ -393,82 +475,231 @@ int CheckMap(void)
     return numProblems;
 }
 
+#pragma mark - Free Slots
+
+// Deleted lines and things and removed vertices stay in their arrays so
+// indices don't change. Their slots are kept on a stack per kind, to be
+// reused by the next object added.
+
+static Array * freeSlots[NUM_MAP_GRIDS];
+static bool freeSlotsValid;
+
+static bool IsFreeSlot(GridKind kind, int index)
+{
+    switch ( kind )
+    {
+        case MAP_VERTICES: return ((Vertex *)Get(map.vertices, index))->removed;
+        case MAP_LINES:    return ((Line *)Get(map.lines, index))->deleted;
+        default:           return ((Thing *)Get(map.things, index))->deleted;
+    }
+}
+
+static void RebuildFreeSlots(void)
+{
+    Array * arrays[NUM_MAP_GRIDS] = { map.vertices, map.lines, map.things };
+
+    for ( int kind = 0; kind < NUM_MAP_GRIDS; kind++ )
+    {
+        if ( freeSlots[kind] == NULL )
+            freeSlots[kind] = NewArray(64, sizeof(int), ARRAY_DOUBLE);
+
+        Clear(freeSlots[kind]);
+
+        for ( int i = 0; i < arrays[kind]->count; i++ )
+            if ( IsFreeSlot(kind, i) )
+                Push(freeSlots[kind], &i);
+    }
+
+    freeSlotsValid = true;
+}
+
+void InvalidateFreeSlots(void)
+{
+    freeSlotsValid = false;
+}
+
+static void ReleaseSlot(GridKind kind, int index)
+{
+    // If the stacks are out of date, the rebuild will find it.
+    if ( freeSlotsValid )
+        Push(freeSlots[kind], &index);
+}
+
+/// Pop a deleted object's index to reuse, or -1 if there are none.
+static int TakeFreeSlot(GridKind kind)
+{
+    if ( !freeSlotsValid )
+        RebuildFreeSlots();
+
+    while ( freeSlots[kind]->count > 0 )
+    {
+        int index;
+        Pop(freeSlots[kind], &index);
+
+        // An index can be stacked more than once.
+        if ( IsFreeSlot(kind, index) )
+            return index;
+    }
+
+    return -1;
+}
+
+static int NumFreeSlots(GridKind kind)
+{
+    if ( !freeSlotsValid )
+        RebuildFreeSlots();
+
+    return freeSlots[kind]->count;
+}
+
+void RemoveVertex(int index)
+{
+    Vertex * vertex = Get(map.vertices, index);
+    if ( vertex->removed )
+        return;
+
+    vertex->referenceCount = 0;
+    vertex->removed = true;
+    UpdateMapGrid(MAP_VERTICES, index);
+    ReleaseSlot(MAP_VERTICES, index);
+}
+
+void DeleteLine(int index)
+{
+    Line * line = Get(map.lines, index);
+    if ( line->deleted )
+        return;
+
+    line->deleted = true;
+    UpdateMapGrid(MAP_LINES, index);
+    UpdateVertexLines(index);
+
+    Vertex * vertices = map.vertices->data;
+    vertices[line->v1].referenceCount--;
+    vertices[line->v2].referenceCount--;
+
+    ReleaseSlot(MAP_LINES, index);
+}
+
+void DeleteThing(int index)
+{
+    Thing * thing = Get(map.things, index);
+    if ( thing->deleted )
+        return;
+
+    thing->deleted = true;
+    UpdateMapGrid(MAP_THINGS, index);
+    ReleaseSlot(MAP_THINGS, index);
+}
+
 #pragma mark -
 
 /// Adds a new vertex to `map.vertices` and returns its index.
 int NewVertex(const SDL_Point * point, bool merge)
 {
-    Vertex * v = map.vertices->data;
-    int i = 0;
+    static Array * candidates;
+    if ( candidates == NULL )
+        candidates = NewArray(16, sizeof(int), 16);
 
     if ( merge )
     {
-        for ( ; i < map.vertices->count; i++, v++ )
+        SDL_Rect rect = { point->x, point->y, 0, 0 };
+        QueryMapGrid(MAP_VERTICES, &rect, candidates);
+
+        int * i;
+        FOR_EACH(i, candidates)
         {
+            Vertex * v = Get(map.vertices, *i);
             if ( v->origin.x == point->x && v->origin.y == point->y )
             {
                 v->referenceCount++;
-                return i;
+                return *i;
             }
         }
     }
 
     Vertex new = { .origin = *point, .referenceCount = 1 };
-    Push(map.vertices, &new);
 
-    return map.vertices->count - 1;
+    int index = TakeFreeSlot(MAP_VERTICES);
+    if ( index == -1 )
+    {
+        Push(map.vertices, &new);
+        index = map.vertices->count - 1;
+    }
+    else
+    {
+        Replace(map.vertices, &new, index);
+    }
+
+    UpdateMapGrid(MAP_VERTICES, index);
+
+    return index;
 }
 
 Line * NewLine(const Line * data,
+               const Sidedef * sides,
                const SDL_Point * p1,
                const SDL_Point * p2,
                bool merge)
 {
+    static Array * candidates;
+    if ( candidates == NULL )
+        candidates = NewArray(16, sizeof(int), 16);
+
     Line * line;
-    int availableIndex = -1;
+    int availableIndex;
 
     if ( merge )
     {
-        // See if we can reuse an existing line.
+        // See if there's already a line here.
         // (The user should not be overlapping one line onto another, so this
         // effectively cancels the action.)
-        for ( int i = 0; i < map.lines->count; i++ )
+        SDL_Rect rect = { p1->x, p1->y, 0, 0 };
+        QueryMapGrid(MAP_LINES, &rect, candidates);
+
+        int * index;
+        FOR_EACH(index, candidates)
         {
-            line = Get(map.lines, i);
+            SDL_Point a, b;
+            GetLinePoints(*index, &a, &b);
 
-            if ( line->deleted )
+            if (   (PointsEqual(&a, p1) && PointsEqual(&b, p2))
+                || (PointsEqual(&a, p2) && PointsEqual(&b, p1)) )
             {
-                availableIndex = i;
-            }
-            else
-            {
-                SDL_Point a, b;
-                GetLinePoints(i, &a, &b);
-
-                if (   (PointsEqual(&a, p1) && PointsEqual(&b, p2))
-                    || (PointsEqual(&a, p2) && PointsEqual(&b, p1)) )
-                {
-                    return line; // There already a line here, do nothing.
-                }
+                // There already a line here, do nothing.
+                return Get(map.lines, *index);
             }
         }
     }
 
+    availableIndex = TakeFreeSlot(MAP_LINES);
+
+    // `data` and `sides` may be in the map's arrays, which can move when
+    // they grow.
+    Line copy = *data;
+    LineSides sidesCopy;
+    memcpy(sidesCopy.sides, sides, sizeof(sidesCopy.sides));
+
     if ( availableIndex != -1 ) // Reuse a previously deleted line.
     {
         line = Get(map.lines, availableIndex);
+        Replace(map.lineSides, &sidesCopy, availableIndex);
     }
     else // There were no unused lines, add a new one.
     {
         Line new;
         line = Push(map.lines, &new);
+        Push(map.lineSides, &sidesCopy);
+        availableIndex = map.lines->count - 1;
     }
 
-    *line = *data;
+    *line = copy;
     line->deleted = false;
 
     line->v1 = NewVertex(p1, merge);
     line->v2 = NewVertex(p2, merge);
+    UpdateMapGrid(MAP_LINES, availableIndex);
+    UpdateVertexLines(availableIndex);
 
     map.boundsDirty = true;
 
@@ -483,7 +714,22 @@ Thing * NewThing(const Thing * thing, const SDL_Point * point)
 
     map.boundsDirty = true;
 
-    return Push(map.things, &new);
+    Thing * added;
+    int index = TakeFreeSlot(MAP_THINGS);
+    if ( index == -1 )
+    {
+        added = Push(map.things, &new);
+        index = map.things->count - 1;
+    }
+    else
+    {
+        added = Get(map.things, index);
+        *added = new;
+    }
+
+    UpdateMapGrid(MAP_THINGS, index);
+
+    return added;
 }
 
 void FlipSelectedLines(void)
@@ -504,76 +750,213 @@ void FlipSelectedLines(void)
 
             // Make sure to swap the sectordefs if two-sided!
             if ( line->flags & ML_TWOSIDED )
-                SWAP(line->sides[0], line->sides[1]);
+            {
+                Sidedef * sides = GetLineSides(i);
+                SWAP(sides[0], sides[1]);
+            }
         }
     }
 }
 
-/// Merge all overlapping vertices.
+/// Merge all overlapping vertices into the one with the lowest index and
+/// point the lines that used them at it.
 void MergeVertices(void)
 {
+    static Array * incident;
+    if ( incident == NULL )
+        incident = NewArray(16, sizeof(int), 16);
+
     Vertex * vertices = map.vertices->data;
+    int count;
+    int * sorted = SortVerticesByPosition(&count);
 
-    for ( int i = 0; i < map.vertices->count; i++ )
+    int keep = count > 0 ? sorted[0] : -1;
+    for ( int i = 1; i < count; i++ )
     {
-        Vertex * v1 = &vertices[i];
-        if ( v1->removed )
-            continue;
+        int j = sorted[i];
 
-        for ( int j = i + 1; j < map.vertices->count; j++ )
+        if ( !PointsEqual(&vertices[keep].origin, &vertices[j].origin) )
         {
-            Vertex * v2 = &vertices[j];
-            if ( v2->removed )
-                continue;
+            keep = j;
+            continue;
+        }
 
-            if ( PointsEqual(&v1->origin, &v2->origin) )
-            {
-                // Update lines that use this points.
-                for ( int k = 0; k < map.lines->count; k++ )
-                {
-                    Line * line = Get(map.lines, k);
+        GetVertexLines(j, incident);
 
-                    if ( line->deleted )
-                        continue;
+        int * index;
+        FOR_EACH(index, incident)
+        {
+            Line * line = Get(map.lines, *index);
 
-                    if ( line->v1 == j )
-                    {
-                        v1->referenceCount++;
-                        line->v1 = i;
-                    }
-                    else if ( line->v2 == j)
-                    {
-                        v1->referenceCount++;
-                        line->v2 = i;
-                    }
-                }
+            if ( line->v1 == j )
+            {
+                line->v1 = keep;
+                vertices[keep].referenceCount++;
+            }
 
-                v2->removed = true;
+            if ( line->v2 == j )
+            {
+                line->v2 = keep;
+                vertices[keep].referenceCount++;
             }
+
+            UpdateVertexLines(*index);
         }
+
+        RemoveVertex(j);
     }
+
+    free(sorted);
 }
 
-void SplitLine(Line * line, const SDL_Point * gridPoint)
+typedef struct
 {
-    if ( line->deleted )
+    SDL_Point point;
+    s64 along; // Distance along the line, scaled by its length.
+} SplitPoint;
+
+static int CompareSplitPoints(const void * a, const void * b)
+{
+    s64 aa = ((const SplitPoint *)a)->along;
+    s64 bb = ((const SplitPoint *)b)->along;
+
+    return (aa > bb) - (aa < bb);
+}
+
+void SplitLineAtPoints(int index, const SDL_Point * points, int count)
+{
+    Line * line = Get(map.lines, index);
+    if ( line->deleted || count == 0 )
         return;
-    
+
     Vertex * vertices = map.vertices->data;
     SDL_Point p1 = vertices[line->v1].origin;
     SDL_Point p2 = vertices[line->v2].origin;
 
-    line->deleted = true;
+    // Put the points in order from p1 to p2.
+    SplitPoint * sorted = malloc(count * sizeof(*sorted));
+    for ( int i = 0; i < count; i++ )
+    {
+        sorted[i].point = points[i];
+        sorted[i].along = (s64)(points[i].x - p1.x) * (p2.x - p1.x)
+                        + (s64)(points[i].y - p1.y) * (p2.y - p1.y);
+    }
+
+    qsort(sorted, count, sizeof(*sorted), CompareSplitPoints);
+
+    // The new lines add their own references.
     line->selected = DESELECTED;
+    DeleteLine(index);
 
-    NewLine(line, &p1, gridPoint, true);
-    NewLine(line, gridPoint, &p2, true);
-    return;
+    // NewLine can move the map's arrays, so split a copy.
+    Line old = *line;
+    LineSides oldSides = *(LineSides *)Get(map.lineSides, index);
+    SDL_Point start = p1;
+
+    for ( int i = 0; i < count; i++ )
+    {
+        // Don't make zero-length lines at repeated points or the ends.
+        if ( PointsEqual(&sorted[i].point, &start)
+            || PointsEqual(&sorted[i].point, &p2) )
+            continue;
+
+        NewLine(&old, oldSides.sides, &start, &sorted[i].point, true);
+        start = sorted[i].point;
+    }
+
+    NewLine(&old, oldSides.sides, &start, &p2, true);
+    free(sorted);
+}
+
+void SplitLine(Line * line, const SDL_Point * gridPoint)
+{
+    SplitLineAtPoints(LineIndex(line), gridPoint, 1);
+}
+
+#pragma mark - Compaction
+
+void CompactMap(void)
+{
+    Vertex * vertices = map.vertices->data;
+    Line * line = map.lines->data;
+    LineSides * sides = map.lineSides->data;
+    Thing * thing = map.things->data;
+
+    // Where each vertex moves to, or -1 if it's dropped. A vertex that a live
+    // line uses is kept even if it was marked removed.
+    int * remap = malloc(map.vertices->count * sizeof(*remap));
+
+    for ( int i = 0; i < map.vertices->count; i++ )
+        remap[i] = vertices[i].removed ? -1 : 0;
+
+    for ( int i = 0; i < map.lines->count; i++ )
+    {
+        if ( !line[i].deleted )
+            remap[line[i].v1] = remap[line[i].v2] = 0;
+    }
+
+    int count = 0;
+    for ( int i = 0; i < map.vertices->count; i++ )
+    {
+        if ( remap[i] != -1 )
+        {
+            vertices[count] = vertices[i];
+            remap[i] = count++;
+        }
+    }
+
+    RemoveRange(map.vertices, count, map.vertices->count - count);
+
+    count = 0;
+    for ( int i = 0; i < map.lines->count; i++ )
+    {
+        if ( !line[i].deleted )
+        {
+            line[count] = line[i];
+            line[count].v1 = remap[line[i].v1];
+            line[count].v2 = remap[line[i].v2];
+            sides[count] = sides[i];
+            count++;
+        }
+    }
+
+    RemoveRange(map.lines, count, map.lines->count - count);
+    RemoveRange(map.lineSides, count, map.lineSides->count - count);
+
+    count = 0;
+    for ( int i = 0; i < map.things->count; i++ )
+    {
+        if ( !thing[i].deleted )
+            thing[count++] = thing[i];
+    }
+
+    RemoveRange(map.things, count, map.things->count - count);
+
+    free(remap);
+
+    InvalidateMapGrid();
+    InvalidateVertexLines();
+    InvalidateFreeSlots();
+}
+
+void CompactMapIfSparse(void)
+{
+    int numFree = NumFreeSlots(MAP_VERTICES)
+                + NumFreeSlots(MAP_LINES)
+                + NumFreeSlots(MAP_THINGS);
+    int total = map.vertices->count + map.lines->count + map.things->count;
+
+    if ( numFree >= COMPACT_MIN_FREE && numFree * COMPACT_FREE_RATIO >= total )
+        CompactMap();
 }
 
 #pragma mark - DWD
 
-static bool ReadLine(FILE * dwd, SDL_Point * p1, SDL_Point *p2, Line * line)
+static bool ReadLine(FILE * dwd,
+                     SDL_Point * p1,
+                     SDL_Point * p2,
+                     Line * line,
+                     Sidedef * sides)
 {
     if ( fscanf(dwd, "(%d,%d) to (%d,%d) : %d : %d : %d\n",
                 &p1->x, &p1->y, &p2->x, &p2->y,
@@ -586,7 +969,7 @@ static bool ReadLine(FILE * dwd, SDL_Point * p1, SDL_Point *p2, Line * line)
 
     for ( int i = 0; i < numSides; i++ )
     {
-        Sidedef * side = &line->sides[i];
+        Sidedef * side = &sides[i];
 
         if ( fscanf(dwd, "    %d (%d : %s / %s / %s )\n",
                     &side->offsetY,
@@ -616,7 +999,7 @@ static bool ReadLine(FILE * dwd, SDL_Point * p1, SDL_Point *p2, Line * line)
     return true;
 }
 
-static void WriteLine(FILE * dwd, Line * line)
+static void WriteLine(FILE * dwd, const Line * line, Sidedef * sides)
 {
     Vertex * vertices = map.vertices->data;
     SDL_Point p1 = vertices[line->v1].origin;
@@ -629,7 +1012,7 @@ static void WriteLine(FILE * dwd, Line * line)
 
     for ( int i = 0; i < numSides; i++ )
     {
-        Sidedef * side = &line->sides[i];
+        Sidedef * side = &sides[i];
 
         if ( strlen(side->top) == 0 )
             strcpy(side->top, "-");
@@ -726,11 +1109,12 @@ void LoadDWD(const char * mapName)
     {
         SDL_Point p1, p2;
         Line line = { 0 };
+        LineSides sides = { 0 };
 
-        if ( !ReadLine(dwd, &p1, &p2, &line) )
+        if ( !ReadLine(dwd, &p1, &p2, &line, sides.sides) )
             goto error;
 
-//        NewLine(&p1, &p2, &line);
+//        NewLine(&line, sides.sides, &p1, &p2, false);
     }
     printf("Loaded %d lines.\n", numLines);
 
@@ -782,7 +1166,7 @@ void SaveDWD(void)
 
     for ( int i = 0; i < map.lines->count; i++ )
         if ( !lines[i].deleted )
-            WriteLine(dwd, &lines[i]);
+            WriteLine(dwd, &lines[i], GetLineSides(i));
 
     // Things
 
@@ -19,11 +19,17 @@
 #define BOUNDS_BORDER 128
 #define MAP_LABEL_LENGTH 6
 
+// Compact once at least 1 / COMPACT_FREE_RATIO of all the map's objects are
+// deleted, and there are at least COMPACT_MIN_FREE of them.
+#define COMPACT_FREE_RATIO 4
+#define COMPACT_MIN_FREE 256
+
 typedef struct
 {
     char label[MAP_LABEL_LENGTH]; // "ExMx" or "MAPxx" + \0
     Array * vertices;
     Array * lines;
+    Array * lineSides; // Each line's sides, at the same index as in `lines`.
     Array * things;
 
     SDL_Rect bounds;
@@ -51,12 +57,39 @@ void SaveDWD(void);
 bool VertexOnLine(const Vertex * vertex, const Line * line);
 SDL_Rect GetMapBounds(void);
 void TranslateCoord(int * y, const SDL_Rect * bounds);
+int NewVertex(const SDL_Point * point, bool merge);
 Line * NewLine(const Line * data,
+               const Sidedef * sides,
                const SDL_Point * p1,
                const SDL_Point * p2,
                bool merge);
 void SplitLine(Line * line, const SDL_Point * gridPoint);
+
+/// Split line `index` into pieces at each of `points`, in one pass. The points
+/// may be in any order.
+void SplitLineAtPoints(int index, const SDL_Point * points, int count);
 Thing * NewThing(const Thing * thing, const SDL_Point * point);
+
+/// Mark vertex `index` as unused. Its slot is reused by the next new vertex.
+void RemoveVertex(int index);
+
+/// Delete line `index` and drop its references to its vertices. Its slot is
+/// reused by the next new line.
+void DeleteLine(int index);
+
+/// Delete thing `index`. Its slot is reused by the next new thing.
+void DeleteThing(int index);
+
+/// Forget which slots are free, after the map's arrays are replaced. They're
+/// found again when next needed.
+void InvalidateFreeSlots(void);
+
+/// Drop deleted lines and things and removed vertices from the map's arrays,
+/// renumbering what's left. Invalidates any indices being held onto.
+void CompactMap(void);
+
+/// Compact the map if enough of it is deleted objects.
+void CompactMapIfSparse(void);
 void FlipSelectedLines(void);
 void MergeVertices(void);
 bool GetClosestSide(const SDL_Point * point, Sidedef * out);
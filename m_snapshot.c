@@ -0,0 +1,169 @@
+//
+//  m_snapshot.c
+//  de
+//
+
+#include "m_snapshot.h"
+
+#include <string.h>
+
+static SnapshotChunk * NewChunk(const void * elements, int count, size_t esize)
+{
+    SnapshotChunk * chunk = malloc(sizeof(*chunk) + count * esize);
+    SDL_AtomicSet(&chunk->references, 1);
+    chunk->count = count;
+    memcpy(chunk->data, elements, count * esize);
+
+    return chunk;
+}
+
+static void ReleaseChunk(SnapshotChunk * chunk)
+{
+    if ( SDL_AtomicDecRef(&chunk->references) )
+        free(chunk);
+}
+
+int NumSnapshotChunks(const SnapshotArray * array)
+{
+    return (array->count + array->chunkLength - 1) / array->chunkLength;
+}
+
+/// Snapshot `source`, sharing chunks that are unchanged in `previous`.
+static void TakeArray(SnapshotArray * array,
+                      const Array * source,
+                      const SnapshotArray * previous)
+{
+    array->esize = source->esize;
+    array->count = source->count;
+    array->chunkLength = MAX(1, SNAPSHOT_CHUNK_SIZE / (int)source->esize);
+
+    int numChunks = NumSnapshotChunks(array);
+    array->chunks = malloc(numChunks * sizeof(*array->chunks) + 1);
+
+    int numPrevious = 0;
+    if ( previous && previous->esize == array->esize )
+        numPrevious = NumSnapshotChunks(previous);
+
+    const u8 * elements = source->data;
+    size_t chunkBytes = array->chunkLength * array->esize;
+
+    for ( int i = 0; i < numChunks; i++, elements += chunkBytes )
+    {
+        int count = MIN(array->chunkLength, array->count - i * array->chunkLength);
+
+        if ( i < numPrevious )
+        {
+            SnapshotChunk * old = previous->chunks[i];
+            if ( old->count == count
+                && memcmp(old->data, elements, count * array->esize) == 0 )
+            {
+                SDL_AtomicIncRef(&old->references);
+                array->chunks[i] = old;
+                continue;
+            }
+        }
+
+        array->chunks[i] = NewChunk(elements, count, array->esize);
+    }
+}
+
+static void CopyArray(SnapshotArray * array, const SnapshotArray * source)
+{
+    *array = *source;
+
+    int numChunks = NumSnapshotChunks(array);
+    array->chunks = malloc(numChunks * sizeof(*array->chunks) + 1);
+
+    for ( int i = 0; i < numChunks; i++ )
+    {
+        array->chunks[i] = source->chunks[i];
+        SDL_AtomicIncRef(&array->chunks[i]->references);
+    }
+}
+
+static void FreeSnapshotArray(SnapshotArray * array)
+{
+    int numChunks = NumSnapshotChunks(array);
+    for ( int i = 0; i < numChunks; i++ )
+        ReleaseChunk(array->chunks[i]);
+
+    free(array->chunks);
+}
+
+static void RestoreArray(Array * destination, const SnapshotArray * array)
+{
+    Clear(destination);
+    Reserve(destination, array->count);
+
+    int numChunks = NumSnapshotChunks(array);
+    for ( int i = 0; i < numChunks; i++ )
+        PushN(destination, array->chunks[i]->data, array->chunks[i]->count);
+}
+
+#pragma mark -
+
+MapSnapshot * TakeMapSnapshot(const MapSnapshot * previous)
+{
+    MapSnapshot * snapshot = malloc(sizeof(*snapshot));
+    snapshot->map = map;
+    snapshot->map.vertices = NULL;
+    snapshot->map.lines = NULL;
+    snapshot->map.lineSides = NULL;
+    snapshot->map.things = NULL;
+
+    TakeArray(&snapshot->vertices, map.vertices, previous ? &previous->vertices : NULL);
+    TakeArray(&snapshot->lines, map.lines, previous ? &previous->lines : NULL);
+    TakeArray(&snapshot->lineSides, map.lineSides, previous ? &previous->lineSides : NULL);
+    TakeArray(&snapshot->things, map.things, previous ? &previous->things : NULL);
+
+    return snapshot;
+}
+
+MapSnapshot * CopyMapSnapshot(const MapSnapshot * snapshot)
+{
+    MapSnapshot * copy = malloc(sizeof(*copy));
+    copy->map = snapshot->map;
+
+    CopyArray(&copy->vertices, &snapshot->vertices);
+    CopyArray(&copy->lines, &snapshot->lines);
+    CopyArray(&copy->lineSides, &snapshot->lineSides);
+    CopyArray(&copy->things, &snapshot->things);
+
+    return copy;
+}
+
+void FreeMapSnapshot(MapSnapshot * snapshot)
+{
+    FreeSnapshotArray(&snapshot->vertices);
+    FreeSnapshotArray(&snapshot->lines);
+    FreeSnapshotArray(&snapshot->lineSides);
+    FreeSnapshotArray(&snapshot->things);
+    free(snapshot);
+}
+
+void RestoreMapSnapshot(const MapSnapshot * snapshot)
+{
+    Array * vertices = map.vertices;
+    Array * lines = map.lines;
+    Array * lineSides = map.lineSides;
+    Array * things = map.things;
+
+    map = snapshot->map;
+    map.vertices = vertices;
+    map.lines = lines;
+    map.lineSides = lineSides;
+    map.things = things;
+
+    RestoreArray(map.vertices, &snapshot->vertices);
+    RestoreArray(map.lines, &snapshot->lines);
+    RestoreArray(map.lineSides, &snapshot->lineSides);
+    RestoreArray(map.things, &snapshot->things);
+}
+
+const void * GetSnapshotElement(const SnapshotArray * array, int index)
+{
+    ASSERT(index >= 0 && index < array->count);
+
+    const SnapshotChunk * chunk = array->chunks[index / array->chunkLength];
+    return chunk->data + (index % array->chunkLength) * array->esize;
+}
@@ -0,0 +1,60 @@
+//
+//  m_snapshot.h
+//  de
+//
+//  Read-only copies of the map, stored in fixed-size reference counted chunks.
+//  Taking a snapshot shares every chunk that's unchanged since an earlier
+//  snapshot, so only the parts of the map that were edited are copied.
+//
+
+#ifndef m_snapshot_h
+#define m_snapshot_h
+
+#include "m_map.h"
+
+/// Bytes of elements in a chunk.
+#define SNAPSHOT_CHUNK_SIZE 4096
+
+typedef struct
+{
+    SDL_atomic_t references; // Snapshots may be freed on other threads.
+    int count;
+    u8 data[];
+} SnapshotChunk;
+
+typedef struct
+{
+    size_t esize;
+    int count;
+    int chunkLength; // Elements per chunk.
+    SnapshotChunk ** chunks;
+} SnapshotArray;
+
+typedef struct
+{
+    Map map; // The map's other fields. Its arrays aren't used.
+    SnapshotArray vertices;
+    SnapshotArray lines;
+    SnapshotArray lineSides;
+    SnapshotArray things;
+} MapSnapshot;
+
+/// Take a snapshot of the current map. Chunks whose contents are the same as
+/// in `previous`, if not NULL, are shared with it rather than copied.
+MapSnapshot * TakeMapSnapshot(const MapSnapshot * previous);
+
+/// Make another reference to `snapshot`'s chunks, without copying any, for
+/// handing to another thread.
+MapSnapshot * CopyMapSnapshot(const MapSnapshot * snapshot);
+
+void FreeMapSnapshot(MapSnapshot * snapshot);
+
+/// Overwrite the current map with `snapshot`.
+void RestoreMapSnapshot(const MapSnapshot * snapshot);
+
+int NumSnapshotChunks(const SnapshotArray * array);
+
+/// Get a pointer to element `index` of a snapshot array.
+const void * GetSnapshotElement(const SnapshotArray * array, int index);
+
+#endif /* m_snapshot_h */
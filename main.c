@@ -18,6 +18,8 @@
 //#include "p_progress_panel.h"
 //#include "p_texture_panel.h"
 #include "e_defaults.h"
+#include "g_resources.h"
+#include "e_journal.h"
 //#include "p_sector_panel.h"
 //#include "g_flat.h"
 
@@ -58,13 +60,15 @@
 // TODO: change to:
 // de [WAD path] (options)
 //
-// de [WAD path] --edit e1m1 --iwad [WAD path]
+// de [WAD path] --edit e1m1 --iwad [WAD path] (--file [WAD paths...])
 // de [WAD path] --list-maps
 // de [WAD path] --list-all
 // ... etc
 // de [WAD path] --copy/-cp [source WAD]:[lump name]
 // de [WAD path] --remove/-rm [lump name]
 // de [WAD path] --set-type [iwad or pwad]
+// de [WAD path] --dedup
+// de [WAD path] --verify/--stats (WAD paths...)
 
 
 
@@ -174,6 +178,30 @@ int RunEditor(const char * wadPath, char * mapName)
     }
     printf("Using IWAD '%s'.\n", iwadPath);
 
+    // Lay any resource PWADs, then the PWAD being edited, over the IWAD.
+    char ** files = NULL;
+    int numFiles = GetOptionArgs("--file", &files);
+
+    Wad ** stack = malloc((numFiles + 2) * sizeof(*stack));
+    stack[0] = editor.iwad;
+    for ( int i = 0; i < numFiles; i++ )
+    {
+        stack[i + 1] = OpenWad(files[i]);
+        if ( stack[i + 1] == NULL )
+        {
+            fprintf(stderr, "Error: could not load resource WAD '%s'\n", files[i]);
+            return EXIT_FAILURE;
+        }
+        printf("Using resource WAD '%s'.\n", files[i]);
+    }
+    stack[numFiles + 1] = editor.pwad;
+
+    editor.iwad = MergeResourceWads(stack, numFiles + 2);
+
+    for ( int i = 0; i <= numFiles; i++ )
+        FreeWad(stack[i]);
+    free(stack);
+
     if ( !LoadMap(editor.pwad, mapName) )
         CreateMap(mapName);
     InitWindow(800, 800); // TODO: save user's favorite window size and position.
@@ -185,6 +213,7 @@ int RunEditor(const char * wadPath, char * mapName)
     DetermineGame(iwadPath);
 
     printf("Editing %s in '%s'\n\n", mapName, wadPath);
+    OpenJournal(wadPath);
 
     InitEditor();
     EditorLoop();
@@ -204,6 +233,39 @@ void ParseListCommand(const char * wadPath)
     }
 }
 
+void ParseDedupCommand(const char * wadPath)
+{
+    if ( GetArg("--dedup") != -1 )
+    {
+        Wad * wad = OpenWad(wadPath);
+        if ( wad == NULL )
+            exit(EXIT_FAILURE);
+
+        wad->deduplicate = true;
+        CompactWAD(wad);
+        FreeWad(wad);
+        exit(0);
+    }
+}
+
+void ParseVerifyCommand(const char * wadPath)
+{
+    bool stats = GetArg("--stats") != -1;
+    const char * option = stats ? "--stats" : "--verify";
+
+    if ( stats || GetArg("--verify") != -1 )
+    {
+        char ** paths;
+        int numPaths = GetOptionArgs(option, &paths);
+
+        int failed = VerifyWadFile(wadPath, stats) != 0;
+        for ( int i = 0; i < numPaths; i++ )
+            failed += VerifyWadFile(paths[i], stats) != 0;
+
+        exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+}
+
 void ParseCopyCommand(const char * wadPath)
 {
     char * copySource = GetOptionArg2("--copy", "-cp");
@@ -221,17 +283,25 @@ void ParseCopyCommand(const char * wadPath)
         }
 
         int index = GetIndexOfLumpNamed(sourceWAD, lumpName);
+        if ( index == -1 )
+        {
+            printf("Error: no lump '%s' in WAD '%s'!\n", lumpName, copySource);
+            exit(EXIT_FAILURE);
+        }
 
+        // Lumps are added in one batch and the destination is saved once.
         if ( GetArg2("--map", "-m") != -1 )
         {
-            for ( int i = index; i < index + ML_COUNT; i++ )
-                CopyLump(destinationWAD, sourceWAD, i);
+            if ( !CopyLumps(destinationWAD, sourceWAD, index, ML_COUNT) )
+                exit(EXIT_FAILURE);
 
             printf("Copied '%s' map lumps to '%s'\n", lumpName, wadPath);
         }
         else
         {
-            CopyLump(destinationWAD, sourceWAD, index);
+            if ( !CopyLumps(destinationWAD, sourceWAD, index, 1) )
+                exit(EXIT_FAILURE);
+
             printf("Copied lump '%s' to '%s'\n", lumpName, wadPath);
         }
 
@@ -262,6 +332,8 @@ int main(int argc, char ** argv)
     char * wadPath = argv[0];
 
     ParseListCommand(wadPath);
+    ParseDedupCommand(wadPath);
+    ParseVerifyCommand(wadPath);
 
 
     char * lumpToRemove = GetOptionArg2("--remove-number", "-rm-num");
@@ -114,11 +114,12 @@ Panel lineSpecialPanel;
 
 // When a line is selected, it is copied here. When any property is changed,
 // this updates the base, then base is copied to all other selected lines.
-Line baseLine = {
-    .sides[0].top = "-",
-    .sides[0].middle = "STARTAN2",
-    .sides[0].bottom = "-",
-    .sides[0].sectorDef = {
+Line baseLine;
+Sidedef baseSides[NUM_SIDES] = {
+    [SIDE_FRONT].top = "-",
+    [SIDE_FRONT].middle = "STARTAN2",
+    [SIDE_FRONT].bottom = "-",
+    [SIDE_FRONT].sectorDef = {
         .floorHeight = 0,
         .ceilingHeight = 128,
         .floorFlat = "FLOOR0_1",
@@ -138,28 +139,31 @@ static bool ProcessSpecialPanelEvent(const SDL_Event * event);
 
 void OpenLinePanel(Line * line)
 {
+    Sidedef * sides = GetLineSides(LineIndex(line));
+
     for ( int i = 0; i < 2; i++ )
     {
-        if ( line->sides[i].top[0] == '\0' )
+        if ( sides[i].top[0] == '\0' )
         {
-            line->sides[i].top[0] = '-';
+            sides[i].top[0] = '-';
             puts("Error: line missing top texture!");
         }
 
-        if ( line->sides[i].middle[0] == '\0' )
+        if ( sides[i].middle[0] == '\0' )
         {
-            line->sides[i].middle[0] = '-';
+            sides[i].middle[0] = '-';
             puts("Error: line missing middle texture!");
         }
 
-        if ( line->sides[i].bottom[0] == '\0' )
+        if ( sides[i].bottom[0] == '\0' )
         {
-            line->sides[i].bottom[0] = '-';
+            sides[i].bottom[0] = '-';
             puts("Error: line missing bottom texture!");
         }
     }
 
     baseLine = *line;
+    memcpy(baseSides, sides, sizeof(baseSides));
 
     OpenPanel(&linePanel);
     UpdateLinePanelContent();
@@ -186,6 +190,8 @@ void LinePanelApplyChange(LineProperty property)
 
         if ( line->selected )
         {
+            Sidedef * sides = GetLineSides(i);
+
             switch ( property )
             {
                 case LINE_BLOCKS_ALL:
@@ -210,19 +216,19 @@ void LinePanelApplyChange(LineProperty property)
                     line->tag = baseLine.tag;
                     break;
                 case LINE_OFFSET_X:
-                    line->sides[s].offsetX = baseLine.sides[s].offsetX;
+                    sides[s].offsetX = baseSides[s].offsetX;
                     break;
                 case LINE_OFFSET_Y:
-                    line->sides[s].offsetY = baseLine.sides[s].offsetY;
+                    sides[s].offsetY = baseSides[s].offsetY;
                     break;
                 case LINE_TOP_TEXTURE:
-                    strncpy(line->sides[s].top, baseLine.sides[s].top, 8);
+                    strncpy(sides[s].top, baseSides[s].top, 8);
                     break;
                 case LINE_MIDDLE_TEXTURE:
-                    strncpy(line->sides[s].middle, baseLine.sides[s].middle, 8);
+                    strncpy(sides[s].middle, baseSides[s].middle, 8);
                     break;
                 case LINE_BOTTOM_TEXTURE:
-                    strncpy(line->sides[s].bottom, baseLine.sides[s].bottom, 8);
+                    strncpy(sides[s].bottom, baseSides[s].bottom, 8);
                     break;
                 case LINE_SIDE_SELECTION:
                     line->panelBackSelected = baseLine.panelBackSelected;
@@ -270,7 +276,7 @@ static void TextEditingCompletionHandler(void)
 
 static void LinePanelAction(int selection)
 {
-    Sidedef * side = &baseLine.sides[baseLine.panelBackSelected];
+    Sidedef * side = &baseSides[baseLine.panelBackSelected];
 
     switch ( selection )
     {
@@ -475,7 +481,7 @@ void ItemPrint(const Panel * panel, int item, const char * string)
 
 void UpdateLinePanelContent(void)
 {
-    Sidedef * side = &baseLine.sides[baseLine.panelBackSelected];
+    Sidedef * side = &baseSides[baseLine.panelBackSelected];
 
     int numSelected = 0;
     int index = -1;
@@ -536,7 +542,7 @@ void UpdateLinePanelContent(void)
 static void RenderLinePanel(void)
 {
     const Line * line = &baseLine;
-    const Sidedef * side = &line->sides[line->panelBackSelected];
+    const Sidedef * side = &baseSides[line->panelBackSelected];
     PanelItem * items = linePanelItems;
 
     //
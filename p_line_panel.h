@@ -14,6 +14,7 @@
 
 extern Panel linePanel;
 extern Line baseLine;
+extern Sidedef baseSides[NUM_SIDES];
 
 void LoadLinePanels(const char * dspPath);
 void OpenLinePanel(Line * line);
@@ -16,13 +16,34 @@ Panel progressPanel;
 static char title[MAX_STR];
 static char info[MAX_STR];
 static float progress;
+static void (* cancel)(void);
 
-void OpenProgressPanel(const char * _title)
+static bool ProgressPanelProcessEvent(const SDL_Event * event)
+{
+    if (   event->type == SDL_KEYDOWN
+        && event->key.keysym.sym == SDLK_ESCAPE
+        && cancel )
+    {
+        cancel();
+        CloseProgressPanel();
+        return true;
+    }
+
+    return false;
+}
+
+void OpenProgressPanel(const char * _title, void (* _cancel)(void))
 {
     OpenPanel(&progressPanel);
     progress = 0.0f;
     strncpy(title, _title, sizeof(title));
     info[0] = '\0';
+    cancel = _cancel;
+}
+
+void CloseProgressPanel(void)
+{
+    ClosePanel(&progressPanel);
 }
 
 void SetProgress(float _progress, const char * _info)
@@ -63,4 +84,5 @@ void LoadProgressPanel(void)
 {
     LoadPanelConsole(&progressPanel, PANEL_DATA_DIRECTORY"progress.panel");
     progressPanel.render = RenderProgressPanel;
+    progressPanel.processEvent = ProgressPanelProcessEvent;
 }
@@ -4,12 +4,14 @@
 //
 //  Created by Thomas Foster on 6/12/23.
 //
-//  This is currently not needed, but keeping it around in case it is.
+//  Shows how far along a long task, like a node build, is.
 
 #ifndef progress_panel_h
 #define progress_panel_h
 
-void OpenProgressPanel(const char * _title);
+/// Open the panel. If `cancel` isn't NULL, pressing Escape calls it and
+/// closes the panel.
+void OpenProgressPanel(const char * _title, void (* _cancel)(void));
 void SetProgress(float _progress, const char * _info);
 void LoadProgressPanel(void);
 void CloseProgressPanel(void);
@@ -77,10 +77,9 @@ void SectorPanelApplyChange(void)
     Line * line;
     FOR_EACH(line, map.lines)
     {
-        if ( line->deleted )
-            continue;
-        else if ( line->selected )
-            line->sides[line->selected - 1].sectorDef = baseSectordef;
+        Sidedef * side = SelectedSide(line);
+        if ( side )
+            side->sectorDef = baseSectordef;
     }
 }
 
@@ -195,10 +194,11 @@ void DoSectorPanelAction(void)
             for ( int i = 0; i < map.lines->count; i++, line++ )
             {
                 int numSides = line->flags & ML_TWOSIDED ? 2 : 1;
+                Sidedef * sides = GetLineSides(i);
                 for ( int s = 0; s < numSides; s++ )
                 {
-                    if ( line->sides[s].sectorDef.tag > maxTag )
-                        maxTag = line->sides[s].sectorDef.tag;
+                    if ( sides[s].sectorDef.tag > maxTag )
+                        maxTag = sides[s].sectorDef.tag;
                 }
             }
             def->tag = maxTag + 1;
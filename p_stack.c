@@ -43,6 +43,19 @@ void CloseTopPanel(void)
 }
 
 
+void ClosePanel(const Panel * panel)
+{
+    int position = GetPanelStackPosition(panel);
+    if ( position == -1 )
+        return;
+
+    for ( int i = position; i < topPanel; i++ )
+        panelStack[i] = panelStack[i + 1];
+
+    topPanel--;
+}
+
+
 void CloseAllPanels(void)
 {
     topPanel = -1;
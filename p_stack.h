@@ -14,6 +14,8 @@
 
 void OpenPanel(Panel * panel);
 void CloseTopPanel(void);
+/// Remove `panel` from the stack, if it's open, leaving any above it open.
+void ClosePanel(const Panel * panel);
 void CloseAllPanels(void);
 void CloseAllPanelsAbove(const Panel * panel);
 
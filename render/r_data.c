@@ -468,7 +468,9 @@ void R_InitTextures (void)
     {
         strncpy (name,name_p+i*8, 8);
 //        patchlookup[i] = W_CheckNumForName (name);
-        patchlookup[i] = GetIndexOfLumpNamed(editor.iwad, name);
+        patchlookup[i] = GetIndexOfLumpInNamespace(editor.iwad, name, NS_PATCHES);
+        if ( patchlookup[i] == -1 )
+            patchlookup[i] = GetIndexOfLumpNamed(editor.iwad, name);
     }
 //    Z_Free (names);
     
@@ -708,7 +710,7 @@ int R_FlatNumForName (char* name)
     int		i;
     char	namet[9];
 
-    i = GetIndexOfLumpNamed (editor.iwad, name);
+    i = GetIndexOfLumpInNamespace (editor.iwad, name, NS_FLATS);
 
     if (i == -1)
     {
@@ -10,18 +10,266 @@
 #include "common.h"
 #include "doomdata.h"
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifndef _WIN32
+#define WAD_MMAP 1
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#else
+struct iovec
+{
+    void * iov_base;
+    size_t iov_len;
+};
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// When more than this fraction of a WAD file is unreferenced lump data and
+// old directories, the next save rewrites it from scratch.
+#define MAX_WASTED_FRACTION 0.5f
+
 static const char * wadTypeNames[] = { "PWAD", "IWAD", "ERR" };
 
-void FreeWad(Wad * wad)
+#pragma mark - Lump Index
+
+typedef struct
+{
+    u64 key; // The lump's 8-character name.
+    LumpNamespace space;
+    int lump; // Index in `wad->lumps`, or -1 if this slot is empty.
+} IndexSlot;
+
+/// Open addressing hash table of lump names. Each lump is entered once under
+/// NS_GLOBAL and, if it's between markers, once under its namespace. Only the
+/// first lump with a given name is entered, matching a front-to-back search.
+struct LumpIndex
+{
+    IndexSlot * slots;
+    int numSlots; // Always a power of two.
+    int count;
+
+    bool dirty; // Lumps were inserted or removed, rebuild before next lookup.
+    LumpNamespace endSpace; // The namespace in effect after the last lump.
+};
+
+static u64 LumpKey(const char * name)
+{
+    char padded[8] = { 0 };
+    strncpy(padded, name, 8);
+
+    u64 key;
+    memcpy(&key, padded, sizeof(key));
+
+    return key;
+}
+
+static u32 HashKey(u64 key, LumpNamespace space)
+{
+    key ^= (u64)space << 59;
+    key *= 0x9E3779B97F4A7C15ull;
+
+    return (u32)(key >> 32);
+}
+
+/// Returns the slot that holds `key` in `space`, or the empty slot where it
+/// would go.
+static IndexSlot * FindSlot(const LumpIndex * index, u64 key, LumpNamespace space)
+{
+    u32 mask = index->numSlots - 1;
+    u32 i = HashKey(key, space) & mask;
+
+    while ( 1 )
+    {
+        IndexSlot * slot = &index->slots[i];
+
+        if ( slot->lump == -1 || (slot->key == key && slot->space == space) )
+            return slot;
+
+        i = (i + 1) & mask;
+    }
+}
+
+static void InsertSlot(LumpIndex * index, u64 key, LumpNamespace space, int lump)
+{
+    IndexSlot * slot = FindSlot(index, key, space);
+    if ( slot->lump != -1 )
+        return; // An earlier lump has this name.
+
+    slot->key = key;
+    slot->space = space;
+    slot->lump = lump;
+    index->count++;
+}
+
+static void ResizeIndex(LumpIndex * index, int numSlots)
 {
+    free(index->slots);
+    index->slots = malloc(numSlots * sizeof(*index->slots));
+    index->numSlots = numSlots;
+    index->count = 0;
+
+    for ( int i = 0; i < numSlots; i++ )
+        index->slots[i].lump = -1;
+}
+
+LumpNamespace NamespaceAfter(const char * name, LumpNamespace space)
+{
+    if ( STRNEQ(name, "S_START", 8) || STRNEQ(name, "SS_START", 8) )
+        return NS_SPRITES;
+    if ( STRNEQ(name, "F_START", 8) || STRNEQ(name, "FF_START", 8) )
+        return NS_FLATS;
+    if ( STRNEQ(name, "P_START", 8) || STRNEQ(name, "PP_START", 8) )
+        return NS_PATCHES;
+
+    if (   STRNEQ(name, "S_END", 8) || STRNEQ(name, "SS_END", 8)
+        || STRNEQ(name, "F_END", 8) || STRNEQ(name, "FF_END", 8)
+        || STRNEQ(name, "P_END", 8) || STRNEQ(name, "PP_END", 8) )
+        return NS_GLOBAL;
+
+    return space;
+}
+
+/// Enter lump number `i`, which must be the last lump in the index so far.
+static void IndexLump(LumpIndex * index, const Lump * lump, int i)
+{
+    // Keep the load factor under 1/2. Each lump takes up to two slots.
+    if ( (index->count + 2) * 2 > index->numSlots )
+    {
+        index->dirty = true;
+        return;
+    }
+
+    u64 key = LumpKey(lump->name);
+    InsertSlot(index, key, NS_GLOBAL, i);
+
+    LumpNamespace next = NamespaceAfter(lump->name, index->endSpace);
+    if ( next != index->endSpace )
+        index->endSpace = next; // Markers are only entered globally.
+    else if ( next != NS_GLOBAL )
+        InsertSlot(index, key, next, i);
+}
+
+static void RebuildIndex(const Wad * wad)
+{
+    LumpIndex * index = wad->index;
+
+    // Leave room for lumps to be appended without a rebuild.
+    int numSlots = 16;
+    while ( numSlots < (wad->lumps->count + 2) * 8 )
+        numSlots *= 2;
+
+    ResizeIndex(index, numSlots);
+    index->endSpace = NS_GLOBAL;
+    index->dirty = false;
+
     Lump * lump = wad->lumps->data;
     for ( int i = 0; i < wad->lumps->count; i++, lump++ )
+        IndexLump(index, lump, i);
+}
+
+#pragma mark - File Mappings
+
+/// A read-only view of a WAD file. Lumps copied to other WADs keep pointing
+/// into it, so it's only unmapped once every WAD that uses it is freed.
+struct WadMapping
+{
+    void * base;
+    size_t size;
+    int references;
+};
+
+/// Keep `mapping` around for as long as `wad` is.
+static void ShareMapping(Wad * wad, WadMapping * mapping)
+{
+    WadMapping ** held;
+    FOR_EACH(held, wad->mappings)
+    {
+        if ( *held == mapping )
+            return;
+    }
+
+    mapping->references++;
+    Push(wad->mappings, &mapping);
+}
+
+static void ReleaseMapping(WadMapping * mapping)
+{
+    if ( --mapping->references > 0 )
+        return;
+
+#if WAD_MMAP
+    munmap(mapping->base, mapping->size);
+#endif
+    free(mapping);
+}
+
+/// Map the whole WAD file read-only. Returns NULL if the file can't be
+/// mapped, in which case lumps are read into memory instead.
+static WadMapping * MapWad(Wad * wad, FILE * stream)
+{
+#if WAD_MMAP
+    struct stat info;
+    if ( fstat(fileno(stream), &info) != 0 || info.st_size == 0 )
+        return NULL;
+
+    void * base = mmap(NULL,
+                       info.st_size,
+                       PROT_READ,
+                       MAP_PRIVATE,
+                       fileno(stream),
+                       0);
+
+    if ( base == MAP_FAILED )
+        return NULL;
+
+    WadMapping * mapping = calloc(1, sizeof(*mapping));
+    mapping->base = base;
+    mapping->size = info.st_size;
+    ShareMapping(wad, mapping);
+
+    return mapping;
+#else
+    (void)wad;
+    (void)stream;
+    return NULL;
+#endif
+}
+
+#pragma mark -
+
+static void FreeLumpData(Lump * lump)
+{
+    if ( !lump->mapped )
         free(lump->data);
 
+    lump->data = NULL;
+    lump->mapped = false;
+}
+
+void FreeWad(Wad * wad)
+{
+    Lump * lump = wad->lumps->data;
+    for ( int i = 0; i < wad->lumps->count; i++, lump++ )
+        FreeLumpData(lump);
+
+    WadMapping ** mapping;
+    FOR_EACH(mapping, wad->mappings)
+        ReleaseMapping(*mapping);
+
+    FreeArray(wad->mappings);
     FreeArray(wad->lumps);
+    free(wad->index->slots);
+    free(wad->index);
     free(wad);
 }
 
@@ -34,7 +282,7 @@ Wad * OpenOrCreateWad(const char * path)
     return CreateWad(path);
 }
 
-Wad * CreateWad(const char * path)
+Wad * NewWad(const char * path)
 {
     Wad * wad = calloc(1, sizeof(*wad));
 
@@ -43,9 +291,20 @@ Wad * CreateWad(const char * path)
         strncpy(wad->path, path, sizeof(wad->path));
         wad->type = PWAD;
         wad->lumps = NewArray(0, sizeof(Lump), 1);
+        wad->mappings = NewArray(1, sizeof(WadMapping *), 1);
+        wad->index = calloc(1, sizeof(*wad->index));
+        wad->index->dirty = true;
+    }
 
+    return wad;
+}
+
+Wad * CreateWad(const char * path)
+{
+    Wad * wad = NewWad(path);
+
+    if ( wad )
         printf("Created WAD '%s'\n", path);
-    }
 
     return wad;
 }
@@ -84,6 +343,8 @@ Wad * OpenWad(const char * path)
     }
 
     wad->lumps = NewArray(header.lumpCount, sizeof(Lump), 1);
+    wad->mappings = NewArray(1, sizeof(WadMapping *), 1);
+    wad->index = calloc(1, sizeof(*wad->index));
 
     // Load the directory.
     fseek(stream, header.directoryOffset, SEEK_SET);
@@ -91,6 +352,13 @@ Wad * OpenWad(const char * path)
     DirectoryEntry * directory = malloc(count * sizeof(*directory));
     fread(directory, sizeof(*directory), count, stream);
 
+    // When the file can be mapped, lumps point straight into the mapping and
+    // are only copied if someone asks to modify them.
+    WadMapping * mapping = MapWad(wad, stream);
+
+    fseek(stream, 0, SEEK_END);
+    wad->fileSize = (u32)ftell(stream);
+
     // Load all lump info and data from WAD.
     for ( int i = 0; i < count; i++ )
     {
@@ -99,11 +367,29 @@ Wad * OpenWad(const char * path)
         strncpy(lump.name, directory[i].name, 8);
         lump.offset = SWAP32(directory[i].offset);
         lump.size = SWAP32(directory[i].size);
+        lump.saved = true;
+
+        // Keep the entry, empty, so the lumps after it keep their numbers.
+        if ( (u64)lump.offset + lump.size > wad->fileSize )
+        {
+            printf("Error: lump '%s' in WAD '%s' is out of bounds!\n",
+                   lump.name, path);
+            lump.size = 0;
+        }
+
         if ( lump.size )
         {
-            lump.data = malloc(lump.size);
-            fseek(stream, lump.offset, SEEK_SET);
-            fread(lump.data, lump.size, 1, stream);
+            if ( mapping )
+            {
+                lump.data = (u8 *)mapping->base + lump.offset;
+                lump.mapped = true;
+            }
+            else
+            {
+                lump.data = malloc(lump.size);
+                fseek(stream, lump.offset, SEEK_SET);
+                fread(lump.data, lump.size, 1, stream);
+            }
         }
 
         Push(wad->lumps, &lump);
@@ -112,6 +398,8 @@ Wad * OpenWad(const char * path)
     free(directory);
     fclose(stream);
 
+    RebuildIndex(wad);
+
     return wad;
 error:
     if ( wad )
@@ -134,6 +422,25 @@ void ListDirectory(const Wad * wad)
 
 // TODO: InsertLump(index)
 
+/// Insert `count` lumps at `wad->position` and advance the position.
+static void InsertLumps(Wad * wad, Lump * lumps, int count)
+{
+    InsertRange(wad->lumps, lumps, wad->position, count);
+
+    // Appending doesn't move any other lumps, so the index is still good.
+    if ( wad->position == wad->lumps->count - count && !wad->index->dirty )
+    {
+        for ( int i = 0; i < count; i++ )
+            IndexLump(wad->index, &lumps[i], wad->position + i);
+    }
+    else
+    {
+        wad->index->dirty = true;
+    }
+
+    wad->position += count;
+}
+
 /// Add lump to WAD at `wad->position`.
 void AddLump(Wad * wad, const char * name, void * data, u32 size)
 {
@@ -150,8 +457,7 @@ void AddLump(Wad * wad, const char * name, void * data, u32 size)
         memcpy(lump.data, data, size);
     }
 
-    Insert(wad->lumps, &lump, wad->position);
-    wad->position++;
+    InsertLumps(wad, &lump, 1);
 }
 
 /// Append new lump to WAD. Does not change the WAD position.
@@ -165,29 +471,56 @@ void AppendLump(Wad * wad, const char * name, void * data, u32 size)
     wad->position = oldPosition;
 }
 
-int GetIndexOfLumpNamed(const Wad * wad, const char * name)
+int GetIndexOfLumpInNamespace(const Wad * wad,
+                              const char * name,
+                              LumpNamespace space)
 {
     char capitalized[9] = { 0 };
     strncpy(capitalized, name, 8);
     SDL_strupr(capitalized);
 
-    Lump * lump = wad->lumps->data;
-    for ( int i = 0; i < wad->lumps->count; i++, lump++ )
+    if ( wad->index->dirty )
+        RebuildIndex(wad);
+
+    return FindSlot(wad->index, LumpKey(capitalized), space)->lump;
+}
+
+int GetIndexOfLumpNamed(const Wad * wad, const char * name)
+{
+    return GetIndexOfLumpInNamespace(wad, name, NS_GLOBAL);
+}
+
+void ReplaceLump(Wad * wad, int index, void * data, u32 size)
+{
+    Lump * lump = Get(wad->lumps, index);
+    FreeLumpData(lump);
+
+    lump->size = size;
+    if ( data != NULL && size > 0 )
     {
-        if ( strncmp(lump->name, capitalized, 8) == 0 )
-            return i;
+        lump->data = malloc(size);
+        memcpy(lump->data, data, size);
     }
 
-    return -1;
+    lump->saved = false;
 }
 
-void RemoveLumpNumber(const Wad * wad, int index)
+void RemoveLumps(const Wad * wad, int index, int count)
 {
-    Lump * lump = Get(wad->lumps, index);
-    if ( lump->data) // Some lumps have no data (labels)
-        free(lump->data);
+    for ( int i = index; i < index + count; i++ )
+    {
+        Lump * lump = Get(wad->lumps, i);
+        if ( lump->data) // Some lumps have no data (labels)
+            FreeLumpData(lump);
+    }
+
+    RemoveRange(wad->lumps, index, count);
+    wad->index->dirty = true;
+}
 
-    Remove(wad->lumps, index);
+void RemoveLumpNumber(const Wad * wad, int index)
+{
+    RemoveLumps(wad, index, 1);
 }
 
 void RemoveLumpNamed(const Wad * wad, const char * name)
@@ -209,62 +542,398 @@ void RemoveMap(const Wad * wad, const char * mapLabel)
         return;
     }
 
-    int i = ML_COUNT;
+    RemoveLumps(wad, index, ML_COUNT);
+}
 
-    // Remove at `index` each time because each call to Remove (array member)
-    // moves all members down one.
-    while ( i-- )
-        RemoveLumpNumber(wad, index);
+/// Mapped lumps are shared rather than copied, so a WAD that takes lumps from
+/// `source` needs to keep its mappings alive.
+static void ShareMappings(Wad * destination, const Wad * source)
+{
+    WadMapping ** mapping;
+    FOR_EACH(mapping, source->mappings)
+        ShareMapping(destination, *mapping);
 }
 
-void CopyLump(Wad * destination, const Wad * source, int lumpIndex)
+/// Point `copy` at the same data as `lump` if it's mapped, otherwise give it
+/// its own copy.
+static void ShareLumpData(Lump * copy, const Lump * lump)
 {
-    Lump * lump = GetLump(source, lumpIndex);
-    AddLump(destination, lump->name, lump->data, lump->size);
-    SaveWAD(destination);
+    copy->size = lump->size;
+
+    if ( lump->mapped )
+    {
+        copy->data = lump->data;
+        copy->mapped = true;
+    }
+    else if ( lump->data != NULL && lump->size > 0 )
+    {
+        copy->data = malloc(lump->size);
+        memcpy(copy->data, lump->data, lump->size);
+    }
 }
 
-void SaveWAD(const Wad * wad)
+bool CopyLumps(Wad * destination, const Wad * source, int index, int count)
 {
-    FILE * output = fopen(wad->path, "w");
-    if ( output == NULL )
+    if ( index < 0 || count < 0 || index + count > source->lumps->count )
     {
-        printf("Error: WAD save failed!\n");
-        return;
+        printf("Error: can't copy lumps %d-%d of WAD '%s', it has %d!\n",
+               index, index + count - 1, source->path, source->lumps->count);
+        return false;
     }
 
-    // Write all lump data.
-    fseek(output, sizeof(WadInfo), SEEK_SET); // Leave room for the header.
-    for ( int i = 0; i < wad->lumps->count; i++ )
+    ShareMappings(destination, source);
+
+    Lump * copies = calloc(count + 1, sizeof(*copies));
+    for ( int i = 0; i < count; i++ )
     {
-        Lump * lump = Get(wad->lumps, i);
-        lump->offset = (u32)ftell(output); // Take note for later.
-        fwrite(lump->data, lump->size, 1, output);
+        Lump * lump = GetLump(source, index + i);
+        memcpy(copies[i].name, lump->name, sizeof(copies[i].name));
+        ShareLumpData(&copies[i], lump);
+    }
+
+    InsertLumps(destination, copies, count);
+    free(copies);
+
+    return true;
+}
+
+void ReplaceLumpFrom(Wad * destination, int index, const Wad * source, int sourceIndex)
+{
+    ShareMappings(destination, source);
+
+    Lump * lump = Get(destination->lumps, index);
+    FreeLumpData(lump);
+    ShareLumpData(lump, GetLump(source, sourceIndex));
+    lump->saved = false;
+}
+
+#pragma mark - Saving
+
+static void SyncFile(FILE * stream)
+{
+    fflush(stream);
+#ifndef _WIN32
+    fsync(fileno(stream));
+#endif
+}
+
+/// Write `count` buffers to `stream`, starting at `offset`. Buffers go out in
+/// batches of up to IOV_MAX per system call, so a whole WAD takes only a few.
+static bool WriteBuffers(FILE * stream, u32 offset, struct iovec * buffers, int count)
+{
+#ifdef WAD_MMAP
+    int fd = fileno(stream);
+    if ( lseek(fd, offset, SEEK_SET) == -1 )
+        return false;
+
+    while ( count > 0 )
+    {
+        ssize_t written = writev(fd, buffers, MIN(count, IOV_MAX));
+        if ( written == -1 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return false;
+        }
+
+        // Skip what was written. A short write can stop partway into a buffer.
+        while ( count > 0 && (size_t)written >= buffers->iov_len )
+        {
+            written -= buffers->iov_len;
+            buffers++;
+            count--;
+        }
+
+        if ( count > 0 )
+        {
+            buffers->iov_base = (u8 *)buffers->iov_base + written;
+            buffers->iov_len -= written;
+        }
+    }
+
+    return true;
+#else
+    fseek(stream, offset, SEEK_SET);
+    for ( int i = 0; i < count; i++ )
+    {
+        if ( buffers[i].iov_len
+            && fwrite(buffers[i].iov_base, buffers[i].iov_len, 1, stream) != 1 )
+            return false;
     }
 
+    return true;
+#endif
+}
+
+/// Entry in the table of lump data already stored in the file while saving
+/// with `wad->deduplicate` set.
+typedef struct
+{
+    u64 hash;
+    int lump; // Index in `wad->lumps`, or -1 if this entry is empty.
+} StoredLump;
+
+static u64 HashLumpData(const void * data, u32 size)
+{
+    const u8 * bytes = data;
+    u64 hash = size;
+
+    for ( ; size >= sizeof(u64); size -= sizeof(u64), bytes += sizeof(u64) )
+    {
+        u64 word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15;
+        hash ^= hash >> 29;
+    }
+
+    while ( size-- )
+        hash = (hash ^ *bytes++) * 0x100000001B3;
+
+    return hash ^ (hash >> 32);
+}
+
+/// Look for an earlier lump with the same data as lump `i`. Returns its index,
+/// or adds lump `i` to the table and returns -1 if there is none.
+static int FindDuplicateLump(StoredLump * table, u32 mask, const Wad * wad, int i)
+{
+    const Lump * lump = Get(wad->lumps, i);
+    u64 hash = HashLumpData(lump->data, lump->size);
+
+    for ( u32 slot = hash & mask; ; slot = (slot + 1) & mask )
+    {
+        if ( table[slot].lump == -1 )
+        {
+            table[slot].hash = hash;
+            table[slot].lump = i;
+            return -1;
+        }
+
+        const Lump * stored = Get(wad->lumps, table[slot].lump);
+        if ( table[slot].hash == hash
+            && stored->size == lump->size
+            && memcmp(stored->data, lump->data, lump->size) == 0 )
+            return table[slot].lump;
+    }
+}
+
+/// Write the WAD to `stream`. If `all` is true, the header, every lump, and the
+/// directory are written from the start of the file. Otherwise, lumps that
+/// aren't already in the file and a new directory are appended at
+/// `wad->fileSize`, and the header is pointed at them only once they're on
+/// disk. Lump data is written straight from where it lives, including the
+/// file mapping. If `wad->deduplicate` is set, lumps with the same data as an
+/// earlier lump point to its copy instead of being written. On success,
+/// `offsets` holds each lump's new offset and `fileSize` the new size of the
+/// file.
+static bool WriteWAD(const Wad * wad, FILE * stream, bool all, u32 * offsets, u32 * fileSize)
+{
+    int count = wad->lumps->count;
+    DirectoryEntry * directory = calloc(count + 1, sizeof(*directory));
+    struct iovec * buffers = malloc((count + 2) * sizeof(*buffers));
+    int numBuffers = 0;
+
     WadInfo header = { 0 };
+    u32 start = all ? 0 : wad->fileSize;
+    u32 position = start;
+
+    if ( all )
+    {
+        buffers[numBuffers++] = (struct iovec){ &header, sizeof(header) };
+        position += sizeof(header);
+    }
+
+    StoredLump * stored = NULL;
+    u32 mask = 0;
+    int duplicates = 0;
+    u32 bytesSaved = 0;
+
+    if ( wad->deduplicate )
+    {
+        u32 tableSize = 16;
+        while ( tableSize < (u32)count * 2 )
+            tableSize *= 2;
+
+        stored = malloc(tableSize * sizeof(*stored));
+        for ( u32 i = 0; i < tableSize; i++ )
+            stored[i].lump = -1;
+        mask = tableSize - 1;
+    }
+
+    Lump * lump = wad->lumps->data;
+    for ( int i = 0; i < count; i++, lump++ )
+    {
+        int original = -1;
+        if ( stored && lump->size )
+            original = FindDuplicateLump(stored, mask, wad, i);
+
+        if ( lump->saved && !all )
+        {
+            offsets[i] = lump->offset;
+        }
+        else if ( original != -1 )
+        {
+            offsets[i] = offsets[original];
+            duplicates++;
+            bytesSaved += lump->size;
+        }
+        else
+        {
+            offsets[i] = position;
+            if ( lump->size )
+            {
+                buffers[numBuffers++] = (struct iovec){ lump->data, lump->size };
+                position += lump->size;
+            }
+        }
+
+        directory[i].offset = SWAP32(offsets[i]);
+        directory[i].size = SWAP32(lump->size);
+        strncpy(directory[i].name, lump->name, 8);
+    }
+
     strncpy(header.identifer, wadTypeNames[wad->type], 4);
-    header.lumpCount = wad->lumps->count;
-    header.directoryOffset = (u32)ftell(output);
+    header.lumpCount = SWAP32(count);
+    header.directoryOffset = SWAP32(position);
 
-    // Write the directory.
-    for ( int i = 0; i < wad->lumps->count; i++ )
+    buffers[numBuffers++] = (struct iovec){ directory, count * sizeof(*directory) };
+    position += count * sizeof(*directory);
+
+    bool ok = WriteBuffers(stream, start, buffers, numBuffers);
+    SyncFile(stream);
+
+    if ( ok && !all )
     {
-        Lump * lump = Get(wad->lumps, i);
+        ok = WriteBuffers(stream, 0, &(struct iovec){ &header, sizeof(header) }, 1);
+        SyncFile(stream);
+    }
 
-        // Make an entry from this lump.
-        DirectoryEntry entry;
-        entry.offset = lump->offset;
-        entry.size = lump->size;
-        strncpy(entry.name, lump->name, 8);
+    *fileSize = position;
 
-        fwrite(&entry, sizeof(entry), 1, output);
+    if ( stored )
+    {
+        printf("Deduplicated %d lumps, saved %u bytes.\n", duplicates, bytesSaved);
+        free(stored);
     }
 
-    // Write the header.
-    rewind(output);
-    fwrite(&header, sizeof(header), 1, output);
+    free(directory);
+    free(buffers);
+
+    return ok;
+}
+
+static void MarkLumpsSaved(Wad * wad, const u32 * offsets, u32 fileSize)
+{
+    Lump * lump = wad->lumps->data;
+    for ( int i = 0; i < wad->lumps->count; i++, lump++ )
+    {
+        lump->offset = offsets[i];
+        lump->saved = true;
+    }
+
+    wad->fileSize = fileSize;
+}
+
+/// Write a complete, compact copy of the WAD next to the original and move it
+/// into place, so a failed save never leaves a half-written WAD behind.
+static bool RewriteWAD(Wad * wad)
+{
+    char tempPath[sizeof(wad->path) + 4];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", wad->path);
+
+    FILE * output = fopen(tempPath, "wb");
+    if ( output == NULL )
+        return false;
+
+    u32 * offsets = malloc((wad->lumps->count + 1) * sizeof(*offsets));
+    u32 fileSize;
+    bool ok = WriteWAD(wad, output, true, offsets, &fileSize);
     fclose(output);
+
+#ifdef _WIN32
+    if ( ok )
+        remove(wad->path); // Windows won't rename over an existing file.
+#endif
+
+    if ( !ok || rename(tempPath, wad->path) != 0 )
+    {
+        remove(tempPath);
+        free(offsets);
+        return false;
+    }
+
+    // Lumps that were mapped still point at the old file's data, which stays
+    // valid until it's unmapped.
+    MarkLumpsSaved(wad, offsets, fileSize);
+    free(offsets);
+
+    return true;
+}
+
+/// Append new and changed lumps and a new directory to the end of the existing
+/// file, then point the header at the new directory. Until the header is
+/// written, the file still describes the WAD as it was before the save.
+static bool AppendToWAD(Wad * wad)
+{
+    FILE * output = fopen(wad->path, "r+b");
+    if ( output == NULL )
+        return false;
+
+    u32 * offsets = malloc((wad->lumps->count + 1) * sizeof(*offsets));
+    u32 fileSize;
+    bool ok = WriteWAD(wad, output, false, offsets, &fileSize);
+    fclose(output);
+
+    if ( ok )
+        MarkLumpsSaved(wad, offsets, fileSize);
+    free(offsets);
+
+    return ok;
+}
+
+/// Returns whether enough of the WAD file is wasted space that it should be
+/// rewritten instead of appended to.
+static bool ShouldCompact(const Wad * wad)
+{
+    if ( wad->fileSize == 0 )
+        return true; // No file yet.
+
+    u32 used = sizeof(WadInfo);
+    u32 unsaved = 0;
+
+    Lump * lump = wad->lumps->data;
+    for ( int i = 0; i < wad->lumps->count; i++, lump++ )
+    {
+        if ( lump->saved )
+            used += lump->size;
+        else
+            unsaved += lump->size;
+    }
+
+    u32 directorySize = wad->lumps->count * sizeof(DirectoryEntry);
+    u32 newFileSize = wad->fileSize + unsaved + directorySize;
+    u32 live = used + unsaved + directorySize;
+
+    // Lumps that share data are counted more than once, which can put `live`
+    // over the file size.
+    if ( live >= newFileSize )
+        return false;
+
+    return newFileSize - live > newFileSize * MAX_WASTED_FRACTION;
+}
+
+void SaveWAD(Wad * wad)
+{
+    if ( !ShouldCompact(wad) && AppendToWAD(wad) )
+        return;
+
+    if ( !RewriteWAD(wad) )
+        printf("Error: WAD save failed!\n");
+}
+
+void CompactWAD(Wad * wad)
+{
+    if ( !RewriteWAD(wad) )
+        printf("Error: WAD save failed!\n");
 }
 
 Lump * GetLumpNamed(const Wad * wad, const char * name)
@@ -290,3 +959,245 @@ const char * GetNameOfLump(const Wad * wad, int index)
 
     return NULL;
 }
+
+#pragma mark - Verification
+
+static const char * mapLumpNames[ML_COUNT] = {
+    [ML_THINGS] = "THINGS",
+    [ML_LINEDEFS] = "LINEDEFS",
+    [ML_SIDEDEFS] = "SIDEDEFS",
+    [ML_VERTEXES] = "VERTEXES",
+    [ML_SEGS] = "SEGS",
+    [ML_SSECTORS] = "SSECTORS",
+    [ML_NODES] = "NODES",
+    [ML_SECTORS] = "SECTORS",
+    [ML_REJECT] = "REJECT",
+    [ML_BLOCKMAP] = "BLOCKMAP",
+};
+
+typedef struct
+{
+    u32 offset;
+    u32 size;
+    int lump;
+} Extent;
+
+static int CompareExtents(const void * a, const void * b)
+{
+    const Extent * e1 = a;
+    const Extent * e2 = b;
+
+    if ( e1->offset != e2->offset )
+        return e1->offset < e2->offset ? -1 : 1;
+    if ( e1->size != e2->size )
+        return e1->size < e2->size ? -1 : 1;
+
+    return 0;
+}
+
+static void ReportProblem(const char * path, int * problems, const char * format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    printf("%s: ", path);
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+
+    (*problems)++;
+}
+
+static bool IsMapLabel(const char * name)
+{
+    if ( name[0] == 'E' && SDL_isdigit(name[1])
+        && name[2] == 'M' && SDL_isdigit(name[3]) && name[4] == '\0' )
+        return true;
+
+    return STRNEQ(name, "MAP", 3)
+        && SDL_isdigit(name[3]) && SDL_isdigit(name[4]) && name[5] == '\0';
+}
+
+int VerifyWadFile(const char * path, bool printStats)
+{
+    FILE * stream = fopen(path, "rb");
+    if ( stream == NULL )
+    {
+        printf("Error: could not open '%s'!\n", path);
+        return -1;
+    }
+
+    fseek(stream, 0, SEEK_END);
+    u32 fileSize = (u32)ftell(stream);
+    rewind(stream);
+
+    WadInfo header;
+    if ( fread(&header, sizeof(header), 1, stream) != 1 )
+    {
+        printf("Error: '%s' is too small to be a WAD!\n", path);
+        fclose(stream);
+        return -1;
+    }
+
+    int problems = 0;
+
+    if (   strncmp(header.identifer, "IWAD", 4) != 0
+        && strncmp(header.identifer, "PWAD", 4) != 0 )
+        ReportProblem(path, &problems, "unknown type '%.4s'", header.identifer);
+
+    u32 count = SWAP32(header.lumpCount);
+    u32 directoryOffset = SWAP32(header.directoryOffset);
+    u64 directoryEnd = directoryOffset + (u64)count * sizeof(DirectoryEntry);
+
+    if ( directoryOffset < sizeof(header) || directoryEnd > fileSize )
+    {
+        ReportProblem(path, &problems,
+                      "directory (%u lumps at offset %u) is outside the file",
+                      count, directoryOffset);
+        printf("%s: %d problems\n", path, problems);
+        fclose(stream);
+        return problems;
+    }
+
+    // Only the directory is read. Lump data is never touched.
+    DirectoryEntry * directory = malloc((count + 1) * sizeof(*directory));
+    Extent * extents = malloc((count + 1) * sizeof(*extents));
+    fseek(stream, directoryOffset, SEEK_SET);
+    if ( fread(directory, sizeof(*directory), count, stream) != count )
+        ReportProblem(path, &problems, "could not read the directory");
+    fclose(stream);
+
+    const char * spaceNames[] = { "global", "sprites", "flats", "patches", "maps" };
+    u64 spaceBytes[5] = { 0 };
+    int spaceLumps[5] = { 0 };
+    int numMaps = 0;
+
+    char openMarkers[8][9]; // Stack of open *_START markers.
+    int numOpenMarkers = 0;
+
+    LumpNamespace space = NS_GLOBAL;
+    int numExtents = 0;
+    int mapLumpsLeft = 0;
+
+    for ( u32 i = 0; i < count; i++ )
+    {
+        char name[9] = { 0 };
+        strncpy(name, directory[i].name, 8);
+        u32 offset = SWAP32(directory[i].offset);
+        u32 size = SWAP32(directory[i].size);
+
+        if ( size > 0 )
+        {
+            if ( (u64)offset + size > fileSize || offset < sizeof(header) )
+                ReportProblem(path, &problems,
+                              "lump %u (%s) at offset %u, size %u is outside the file",
+                              i, name, offset, size);
+            else
+                extents[numExtents++] = (Extent){ offset, size, i };
+        }
+
+        // Markers
+        char * suffix = strchr(name, '_');
+        if ( size == 0 && suffix && strcmp(suffix, "_START") == 0 )
+        {
+            if ( numOpenMarkers == 8 )
+                ReportProblem(path, &problems, "markers nested too deeply at lump %u", i);
+            else
+                snprintf(openMarkers[numOpenMarkers++], 9, "%.*s",
+                         (int)(suffix - name), name);
+        }
+        else if ( size == 0 && suffix && strcmp(suffix, "_END") == 0 )
+        {
+            if ( numOpenMarkers == 0
+                || strncmp(openMarkers[numOpenMarkers - 1], name, suffix - name) != 0
+                || openMarkers[numOpenMarkers - 1][suffix - name] != '\0' )
+                ReportProblem(path, &problems, "%s at lump %u has no matching start", name, i);
+            else
+                numOpenMarkers--;
+        }
+
+        space = NamespaceAfter(name, space);
+
+        // Maps
+        bool nextIsThings = i + 1 < count
+            && STRNEQ(directory[i + 1].name, "THINGS", 8);
+
+        if ( mapLumpsLeft == 0 && (nextIsThings || (size == 0 && IsMapLabel(name))) )
+        {
+            numMaps++;
+            mapLumpsLeft = ML_COUNT;
+
+            for ( int j = ML_THINGS; j < ML_COUNT; j++ )
+            {
+                if ( i + j >= count || !STRNEQ(directory[i + j].name, mapLumpNames[j], 8) )
+                {
+                    ReportProblem(path, &problems, "map %s is missing %s", name, mapLumpNames[j]);
+                    mapLumpsLeft = j;
+                    break;
+                }
+            }
+        }
+
+        int bucket = mapLumpsLeft > 0 ? 4 : space;
+        spaceBytes[bucket] += size;
+        spaceLumps[bucket]++;
+
+        if ( mapLumpsLeft > 0 )
+            mapLumpsLeft--;
+    }
+
+    for ( int i = numOpenMarkers - 1; i >= 0; i-- )
+        ReportProblem(path, &problems, "%s_START has no matching end", openMarkers[i]);
+
+    // Sort lumps by where they are in the file to find overlaps and how much
+    // of the file isn't used. Lumps that share the same data are fine.
+    qsort(extents, numExtents, sizeof(*extents), CompareExtents);
+
+    u64 usedBytes = sizeof(header) + (directoryEnd - directoryOffset);
+    u64 coveredEnd = 0;
+    int coveringLump = -1; // The lump that reaches coveredEnd.
+    for ( int i = 0; i < numExtents; i++ )
+    {
+        const Extent * e = &extents[i];
+        u64 end = (u64)e->offset + e->size;
+
+        if ( e->offset < directoryEnd && end > directoryOffset )
+            ReportProblem(path, &problems, "lump %d overlaps the directory", e->lump);
+
+        if ( i > 0 && e->offset < coveredEnd
+            && CompareExtents(e, &extents[i - 1]) != 0 )
+            ReportProblem(path, &problems, "lumps %d and %d overlap",
+                          coveringLump, e->lump);
+
+        if ( end > coveredEnd )
+        {
+            usedBytes += end - MAX(coveredEnd, (u64)e->offset);
+            coveredEnd = end;
+            coveringLump = e->lump;
+        }
+    }
+
+    if ( printStats )
+    {
+        printf("%s: %.4s, %u lumps, %d maps, %u bytes\n",
+               path, header.identifer, count, numMaps, fileSize);
+
+        for ( int i = 0; i < 5; i++ )
+            printf("  %-9s %6d lumps %10llu bytes\n",
+                   spaceNames[i], spaceLumps[i], (unsigned long long)spaceBytes[i]);
+
+        printf("  %-9s %6u lumps %10llu bytes\n", "directory", count,
+               (unsigned long long)(directoryEnd - directoryOffset));
+        printf("  %-9s %23llu bytes\n", "unused",
+               (unsigned long long)(fileSize > usedBytes ? fileSize - usedBytes : 0));
+    }
+
+    if ( problems == 0 )
+        printf("%s: OK\n", path);
+    else
+        printf("%s: %d problem%s\n", path, problems, problems == 1 ? "" : "s");
+
+    free(directory);
+    free(extents);
+
+    return problems;
+}
@@ -11,6 +11,7 @@
 #include "array.h"
 #include "common.h"
 #include <stdio.h>
+#include <stdbool.h>
 
 typedef struct
 {
@@ -38,30 +39,92 @@ typedef struct
     int size;
     char name[9];
     void * data;
+    bool mapped; // `data` points into a read-only file mapping.
+    bool saved; // `data` is unchanged from what's at `offset` in the file.
 } Lump;
 
+/// Lump name lookups can be restricted to lumps between a pair of markers,
+/// so a sprite and a flat with the same name can both be found.
+typedef enum
+{
+    NS_GLOBAL,  // Any lump in the WAD.
+    NS_SPRITES, // Between S_START and S_END.
+    NS_FLATS,   // Between F_START and F_END.
+    NS_PATCHES, // Between P_START and P_END.
+} LumpNamespace;
+
+/// If `name` is a namespace marker, returns the namespace that follows it.
+/// Otherwise returns `space`.
+LumpNamespace NamespaceAfter(const char * name, LumpNamespace space);
+
+typedef struct LumpIndex LumpIndex;
+typedef struct WadMapping WadMapping;
+
 typedef struct {
     char path[256];
     enum { PWAD, IWAD, UNKNOWN_WAD } type;
     Array * lumps; // Lump[]
     int position; // The index at which lumps are added with `AddLump`.
+    LumpIndex * index; // Hash of lump names, kept in sync with `lumps`.
+
+    Array * mappings; // WadMapping *[], file mappings that lumps point into.
+    u32 fileSize; // Size of the WAD file as of the last load or save.
+    bool deduplicate; // Store lumps with identical data once when saving.
 } Wad;
 
+/// Make an empty WAD in memory. Nothing is written to `path` until it's saved.
+Wad * NewWad(const char * path);
 Wad * CreateWad(const char * path);
 Wad * OpenWad(const char * path);
 Wad * OpenOrCreateWad(const char * path);
-void  SaveWAD(const Wad * wad);
+/// Save changes to the WAD. New and modified lumps and a new directory are
+/// appended to the existing file. If the file doesn't exist yet or too much of
+/// it is wasted space, it's rewritten instead.
+void  SaveWAD(Wad * wad);
+
+/// Save the WAD by writing a fresh copy with no wasted space and renaming it
+/// over the original.
+void  CompactWAD(Wad * wad);
 void  FreeWad(Wad * wad);
 
 void ListDirectory(const Wad * wad);
 
+/// Check the WAD file at `path` using only its directory: that every lump is
+/// in the file, that no lumps partly overlap, that markers are paired, and that
+/// each map has all of its lumps. Prints any problems and, if `printStats`,
+/// byte totals per namespace. Returns the number of problems, or -1 if the file
+/// can't be read.
+int VerifyWadFile(const char * path, bool printStats);
+
 void AddLump(Wad * wad, const char * name, void * data, u32 size);
+
+/// Replace the data of the lump at `index`. The lump keeps its name and place
+/// in the directory, so no other lumps move and the name index stays valid.
+void ReplaceLump(Wad * wad, int index, void * data, u32 size);
+
+/// Remove `count` lumps starting at `index`, moving later lumps down once.
+void RemoveLumps(const Wad * wad, int index, int count);
 void RemoveLumpNumber(const Wad * wad, int index);
 void RemoveLumpNamed(const Wad * wad, const char * name);
 void RemoveMap(const Wad * wad, const char * mapLabel);
-void CopyLump(Wad * destination, const Wad * source, int lumpIndex);
 
+/// Add `count` lumps from `source`, starting at `index`, to `destination` at its
+/// position. Lumps still in `source`'s file mapping are shared, not copied.
+/// Returns false if the range is out of bounds.
+bool CopyLumps(Wad * destination, const Wad * source, int index, int count);
+
+/// Replace the data of lump `index` in `destination` with that of lump
+/// `sourceIndex` in `source`, sharing it if it's mapped as with `CopyLumps`.
+void ReplaceLumpFrom(Wad * destination, int index, const Wad * source, int sourceIndex);
+
+/// Get the index of the first lump with `name`, or -1 if there is none.
 int GetIndexOfLumpNamed(const Wad * wad, const char * name);
+
+/// Get the index of the first lump with `name` in the given namespace, or -1 if
+/// there is none.
+int GetIndexOfLumpInNamespace(const Wad * wad,
+                              const char * name,
+                              LumpNamespace space);
 const char * GetNameOfLump(const Wad * wad, int index);
 Lump * GetLumpNamed(const Wad * wad, const char * name);
 Lump * GetLump(const Wad * wad, int i);